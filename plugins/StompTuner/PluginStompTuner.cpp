@@ -9,10 +9,10 @@
 #include "resampler.cc"
 #include "resampler-table.cc"
 #include "gx_resampler.cc"
+#include "decimator.cc"
 
 #include "PluginStompTuner.hpp"
 #include "tuner.cc"
-#include "low_high_cut.cc"
 
 START_NAMESPACE_DISTRHO
 
@@ -20,27 +20,23 @@ START_NAMESPACE_DISTRHO
 
 PluginStompTuner::PluginStompTuner()
     : Plugin(paramCount, 0, 0),
-      srChanged(false),
       needs_ramp_down(false),
       needs_ramp_up(false),
       bypassed(false),
       bypass_(2)
 {
-    lhcut = new low_high_cut::Dsp();
-    dsp = new tuner([this] () {this->setFreq();});
+    dsp = new tuner();
     for (unsigned p = 0; p < paramCount; ++p) {
         Parameter param;
         initParameter(p, param);
         setParameterValue(p, param.ranges.def);
     }
-    lhcut->init_static(getSampleRate(), lhcut);
     dsp->init(getSampleRate());
 }
 
 PluginStompTuner::~PluginStompTuner() {
     //dsp->activate(false);
     if (dsp) delete dsp;
-    if (lhcut) delete lhcut;
 }
 
 // -----------------------------------------------------------------------
@@ -78,15 +74,30 @@ void PluginStompTuner::initParameter(uint32_t index, Parameter& parameter) {
             parameter.ranges.def = 440.0f;
             parameter.hints = kParameterIsAutomatable;
             break;
+        case QUALITY:
+            parameter.name = "Analysis Quality";
+            parameter.shortName = "Quality";
+            parameter.symbol = "QUALITY";
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = 3.0f;
+            parameter.ranges.def = 3.0f;
+            parameter.hints = kParameterIsOutput|kParameterIsInteger;
+            break;
     }
 }
 
 // -----------------------------------------------------------------------
 // Internal data
 
+// pick up the newest estimate from the analysis thread, called once per block,
+// together with the quality level the load allows (3 is full quality)
 void PluginStompTuner::setFreq() {
-    setOutputParameterValue(FREQ, dsp->get_freq());
-    //fprintf(stderr, "Freq %f\n", fParams[FREQ]);
+    float freq;
+    if (dsp->get_new_freq(freq)) {
+        setOutputParameterValue(FREQ, freq);
+        //fprintf(stderr, "Freq %f\n", fParams[FREQ]);
+    }
+    setOutputParameterValue(QUALITY, dsp->get_quality());
 }
 
 /**
@@ -94,11 +105,11 @@ void PluginStompTuner::setFreq() {
 */
 void PluginStompTuner::sampleRateChanged(double newSampleRate) {
     fSampleRate = newSampleRate;
-    srChanged = true;
-    lhcut->init_static(fSampleRate, lhcut);
-    dsp->activate(false);
+    // the host is getting ready to run, do the setup for the
+    // new rate now instead of in activate(). The dsp goes on with
+    // the old setup until it takes the new one in run().
     dsp->init(fSampleRate);
-    srChanged = false;
+    dsp->prewarm();
 }
 
 /**
@@ -134,12 +145,17 @@ void PluginStompTuner::activate() {
     ramp_up_step = ramp_down_step;
     ramp_down = ramp_down_step;
     ramp_up = 0.0;
+    dsp->activate(true);
+}
+
+void PluginStompTuner::deactivate() {
+    // plugin is deactivated
+    dsp->activate(false);
 }
 
 void PluginStompTuner::run(const float** inputs, float** outputs,
                               uint32_t frames) {
 
-    if (srChanged) return;
     // get the left and right audio inputs
     const float* const inpL = inputs[0];
    // const float* const inpR = inputs[1];
@@ -153,8 +169,6 @@ void PluginStompTuner::run(const float** inputs, float** outputs,
         memcpy(outL, inpL, frames*sizeof(float));
 
     float buf0[frames];
-    float buf[frames];
-    memcpy(buf, inpL, frames*sizeof(float));
     // check if bypass is pressed
     if (bypass_ != static_cast<uint32_t>(fParams[dpf_bypass])) {
         bypass_ = static_cast<uint32_t>(fParams[dpf_bypass]);
@@ -172,8 +186,9 @@ void PluginStompTuner::run(const float** inputs, float** outputs,
          memcpy(buf0, inpL, frames*sizeof(float));
     }
     if (!bypassed) {
-        lhcut->compute_static(frames, buf, buf, lhcut);
-        dsp->feed_tuner(frames, buf);
+        // low/high cut is done by the tuner on the decimated stream
+        dsp->feed_tuner(frames, inpL);
+        setFreq();
     }
     // check if ramping is needed
     if (needs_ramp_down) {
@@ -13,7 +13,6 @@
 #include <functional>
 
 #include "zita-resampler/resampler.h"
-#include "low_high_cut.h"
 #include "tuner.hpp"
 
 START_NAMESPACE_DISTRHO
@@ -42,6 +41,7 @@ public:
         dpf_bypass = 0,
         FREQ,
         REFFREQ,
+        QUALITY,
         paramCount
     };
 
@@ -109,6 +109,7 @@ protected:
     // Process
 
     void activate() override;
+    void deactivate() override;
 
     void run(const float**, float** outputs, uint32_t frames) override;
 
@@ -118,7 +119,6 @@ protected:
 private:
     float           fParams[paramCount];
     double          fSampleRate;
-    bool            srChanged;
     // bypass ramping
     bool needs_ramp_down;
     bool needs_ramp_up;
@@ -129,7 +129,6 @@ private:
     bool bypassed;
     uint32_t bypass_;
     // pointer to dsp class
-    low_high_cut::Dsp* lhcut;
     tuner* dsp;
 
     DISTRHO_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PluginStompTuner)
@@ -0,0 +1,164 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#include "decimator.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+/////////////////////////  HalfbandStage   ////////////////////////
+
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// kaiser windowed sinc (beta 7), normalized to unity gain at DC
+struct HalfbandCoef {
+    float c[(HalfbandStage::TAPS + 1) / 4 + 1];
+
+    HalfbandCoef() {
+        const int mid = HalfbandStage::TAPS / 2;
+        const int nc = (HalfbandStage::TAPS + 1) / 4;
+        const double beta = 7.0;
+        double h[nc + 1];
+        h[0] = 0.5;
+        double sum = h[0];
+        for (int k = 1; k <= nc; k++) {
+            const int n = 2 * k - 1;
+            const double r = static_cast<double>(n) / mid;
+            h[k] = sin(M_PI * n / 2) / (M_PI * n)
+                   * bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+            sum += 2.0 * h[k];
+        }
+        for (int k = 0; k <= nc; k++) {
+            c[k] = h[k] / sum;
+        }
+    }
+};
+
+static const float *halfband_coef() {
+    static const HalfbandCoef coef;
+    return coef.c;
+}
+
+HalfbandStage::HalfbandStage()
+    : m_coef(halfband_coef()),
+      m_buf(new float[TAPS + MAX_BLOCK]),
+      m_fill(0) {
+    reset();
+}
+
+HalfbandStage::~HalfbandStage() {
+    delete[] m_buf;
+}
+
+void HalfbandStage::reset() {
+    memset(m_buf, 0, (TAPS + MAX_BLOCK) * sizeof(*m_buf));
+    m_fill = TAPS - 1;
+}
+
+void HalfbandStage::copy_state(const HalfbandStage& other) {
+    // only the samples kept for the next block
+    memcpy(m_buf, other.m_buf, other.m_fill * sizeof(*m_buf));
+    m_fill = other.m_fill;
+}
+
+int HalfbandStage::process(int count, const float *input, float *output) {
+    memmove(m_buf + m_fill, input, count * sizeof(*m_buf));
+    const int total = m_fill + count;
+    const int mid = TAPS / 2;
+    int n = 0;
+    for (int j = 0; j + TAPS <= total; j += 2) {
+        const float *x = m_buf + j + mid;
+        float s = m_coef[0] * x[0];
+        for (int k = 1; k <= (TAPS + 1) / 4; k++) {
+            s += m_coef[k] * (x[1 - 2 * k] + x[2 * k - 1]);
+        }
+        output[n++] = s;
+    }
+    // keep what the next block still needs
+    m_fill = total - 2 * n;
+    memmove(m_buf, m_buf + 2 * n, m_fill * sizeof(*m_buf));
+    return n;
+}
+
+/////////////////////////  Decimator   ////////////////////////
+
+Decimator::Decimator()
+    : m_nstages(0),
+      m_resamp(),
+      m_tmp(new float[MAX_BLOCK]),
+      m_ratio(1.0) {
+}
+
+Decimator::~Decimator() {
+    delete[] m_tmp;
+}
+
+int Decimator::setup(unsigned int fs_inp, unsigned int fs_out) {
+    m_nstages = 0;
+    if (fs_out) {
+        while (fs_inp >= 4 * fs_out && !(fs_inp & 1) && m_nstages < MAX_STAGES) {
+            fs_inp /= 2;
+            m_nstages++;
+        }
+    }
+    for (int i = 0; i < m_nstages; i++) {
+        m_stage[i].reset();
+    }
+    m_ratio = fs_inp ? static_cast<double>(fs_out) / fs_inp / (1 << m_nstages) : 1.0;
+    return m_resamp.setup(fs_inp, fs_out);
+}
+
+void Decimator::reset() {
+    for (int i = 0; i < m_nstages; i++) {
+        m_stage[i].reset();
+    }
+    m_resamp.reset();
+}
+
+bool Decimator::copy_state(const Decimator& other) {
+    if (m_nstages != other.m_nstages || m_ratio != other.m_ratio) {
+        return false;
+    }
+    if (m_resamp.copy_state(other.m_resamp) != 0) {
+        return false;
+    }
+    for (int i = 0; i < m_nstages; i++) {
+        m_stage[i].copy_state(other.m_stage[i]);
+    }
+    return true;
+}
+
+int Decimator::max_input(int out_count) const {
+    // the resampler could emit one extra sample per call
+    int n = static_cast<int>((out_count - 2) / m_ratio);
+    return std::max(1, std::min(n, static_cast<int>(MAX_BLOCK)));
+}
+
+int Decimator::process(int count, const float *input, float *output) {
+    const float *in = input;
+    for (int i = 0; i < m_nstages; i++) {
+        count = m_stage[i].process(count, in, m_tmp);
+        in = m_tmp;
+    }
+    const int out_count = static_cast<int>(ceil(count * m_ratio * (1 << m_nstages))) + 2;
+    m_resamp.inp_count = count;
+    m_resamp.inp_data = const_cast<float*>(in);
+    m_resamp.out_count = out_count;
+    m_resamp.out_data = output;
+    if (m_resamp.process()) {
+        return 0;
+    }
+    return out_count - m_resamp.out_count;
+}
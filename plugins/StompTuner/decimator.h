@@ -0,0 +1,82 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#pragma once
+
+#ifndef DECIMATOR_H_
+#define DECIMATOR_H_
+
+#include <zita-resampler/resampler-fixed.h>
+
+/****************************************************************
+ ** HalfbandStage
+ **
+ ** 2:1 polyphase halfband decimator, 19 taps (kaiser window),
+ ** every other coefficient is zero, so it costs 6 multiplies
+ ** per output sample. Passband up to 0.125 fs, >70dB rejection
+ ** above 0.375 fs.
+ */
+
+class HalfbandStage {
+public:
+    static const int TAPS = 19;
+    static const int MAX_BLOCK = 1024;
+
+    HalfbandStage();
+    ~HalfbandStage();
+    void reset();
+    void copy_state(const HalfbandStage& other);
+    // in and out may point to the same buffer, returns the number of outputs
+    int  process(int count, const float *input, float *output);
+
+private:
+    // center tap followed by the odd side coefficients
+    const float *m_coef;
+    // delay line followed by the current block
+    float       *m_buf;
+    int          m_fill;
+};
+
+/****************************************************************
+ ** Decimator
+ **
+ ** analysis front-end: halfband stages bring the host rate down while it is
+ ** at least 4 times the target rate, one mono Resampler_fixed stage with a
+ ** compile-time half length does the remaining fractional step. That keeps
+ ** the resampler filter short and the cost about the same for 44.1k up to
+ ** 768k host rates, and avoids the ratios zita refuses above 328k.
+ */
+
+class Decimator {
+public:
+    static const int MAX_STAGES = 6;
+    static const int MAX_BLOCK = HalfbandStage::MAX_BLOCK;
+    static const unsigned int RESAMP_HLEN = 32;
+
+    Decimator();
+    ~Decimator();
+    // returns 0 on success, like Resampler::setup()
+    int  setup(unsigned int fs_inp, unsigned int fs_out);
+    void reset();
+    // continue with the filter state of another one set up for the same
+    // rates, returns false when the setup differs
+    bool copy_state(const Decimator& other);
+    int  stages() const { return m_nstages; }
+    // largest input block whose output fits into out_count samples
+    int  max_input(int out_count) const;
+    // returns the number of samples written to output
+    int  process(int count, const float *input, float *output);
+
+private:
+    int           m_nstages;
+    HalfbandStage m_stage[MAX_STAGES];
+    Resampler_fixed<1, RESAMP_HLEN> m_resamp;
+    float        *m_tmp;
+    // overall ratio fs_out / fs_inp
+    double        m_ratio;
+};
+
+#endif  // DECIMATOR_H_
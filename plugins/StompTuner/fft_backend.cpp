@@ -0,0 +1,269 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#include "fft_backend.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#ifndef STOMPTUNER_NO_FFTW
+#include "fft_plans.h"
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/////////////////////////  Buffers   ////////////////////////
+
+static const size_t FFT_ALIGN = 64;
+
+// the offset to the real allocation is stored just in front of the buffer
+float *FftBackend::alloc_buffer(size_t count) {
+    unsigned char *raw = static_cast<unsigned char*>(malloc(count * sizeof(float) + FFT_ALIGN));
+    if (!raw) {
+        return 0;
+    }
+    size_t offset = FFT_ALIGN - (reinterpret_cast<uintptr_t>(raw) & (FFT_ALIGN - 1));
+    raw[offset - 1] = static_cast<unsigned char>(offset);
+    return reinterpret_cast<float*>(raw + offset);
+}
+
+void FftBackend::free_buffer(float *buf) {
+    if (!buf) {
+        return;
+    }
+    unsigned char *p = reinterpret_cast<unsigned char*>(buf);
+    free(p - p[-1]);
+}
+
+/////////////////////////  FFTW backend   ////////////////////////
+
+#ifndef STOMPTUNER_NO_FFTW
+
+class FftwBackend : public FftBackend {
+private:
+    FftPlans::Plan *m_fwd;
+    FftPlans::Plan *m_bwd;
+
+public:
+    FftwBackend(int size)
+        : m_fwd(FftPlans::acquire(size, FFTW_R2HC)),
+          m_bwd(FftPlans::acquire(size, FFTW_HC2R)) {}
+    ~FftwBackend() {
+        FftPlans::release(m_fwd);
+        FftPlans::release(m_bwd);
+    }
+    bool is_valid() const override { return m_fwd && m_bwd; }
+    const char *name() const override { return "fftw"; }
+    void forward(float *in, float *out) override { m_fwd->execute(in, out); }
+    void backward(float *in, float *out) override { m_bwd->execute(in, out); }
+};
+
+#endif
+
+FftBackend *FftBackend::create(int size) {
+    FftBackend *fft = 0;
+#ifndef STOMPTUNER_NO_FFTW
+    const char *want = getenv("STOMPTUNER_FFT");
+    if (!want || strcmp(want, "builtin") != 0) {
+        fft = new FftwBackend(size);
+        if (fft->is_valid()) {
+            return fft;
+        }
+        delete fft;
+    }
+#endif
+    fft = new BuiltinFft(size);
+    return fft;
+}
+
+/////////////////////////  Builtin backend   ////////////////////////
+
+BuiltinFft::BuiltinFft(int size)
+    : m_size(size),
+      m_half(size / 2),
+      m_nstages(0),
+      m_wRe(0),
+      m_wIm(0),
+      m_valid(false) {
+    m_re[0] = m_re[1] = m_im[0] = m_im[1] = 0;
+    int m = m_half;
+    if (size < 4 || (size & 1)) {
+        return;
+    }
+    // factorize the complex size, radix 3 first
+    while (m % 3 == 0) {
+        m_radix[m_nstages++] = 3;
+        m /= 3;
+    }
+    while (m % 2 == 0) {
+        m_radix[m_nstages++] = 2;
+        m /= 2;
+    }
+    if (m != 1) {
+        m_nstages = 0;
+        return;
+    }
+    int span = 1;
+    for (int s = 0; s < m_nstages; s++) {
+        const int r = m_radix[s];
+        m_twRe[s] = alloc_buffer((r - 1) * span);
+        m_twIm[s] = alloc_buffer((r - 1) * span);
+        for (int q = 1; q < r; q++) {
+            for (int k = 0; k < span; k++) {
+                const double a = -2.0 * M_PI * q * k / (span * r);
+                m_twRe[s][(q - 1) * span + k] = cos(a);
+                m_twIm[s][(q - 1) * span + k] = sin(a);
+            }
+        }
+        span *= r;
+    }
+    m_wRe = alloc_buffer(m_half + 1);
+    m_wIm = alloc_buffer(m_half + 1);
+    for (int k = 0; k <= m_half; k++) {
+        const double a = -2.0 * M_PI * k / m_size;
+        m_wRe[k] = cos(a);
+        m_wIm[k] = sin(a);
+    }
+    for (int i = 0; i < 2; i++) {
+        m_re[i] = alloc_buffer(m_half);
+        m_im[i] = alloc_buffer(m_half);
+    }
+    m_valid = true;
+}
+
+BuiltinFft::~BuiltinFft() {
+    for (int s = 0; s < m_nstages; s++) {
+        free_buffer(m_twRe[s]);
+        free_buffer(m_twIm[s]);
+    }
+    free_buffer(m_wRe);
+    free_buffer(m_wIm);
+    for (int i = 0; i < 2; i++) {
+        free_buffer(m_re[i]);
+        free_buffer(m_im[i]);
+    }
+}
+
+// forward complex transform of m_half points, Stockham autosort,
+// so each pass reads one buffer and writes the other in natural order
+int BuiltinFft::complex_fft(int src) {
+    const int n = m_half;
+    int span = 1;
+    for (int s = 0; s < m_nstages; s++) {
+        const float *xr = m_re[src];
+        const float *xi = m_im[src];
+        float *yr = m_re[src ^ 1];
+        float *yi = m_im[src ^ 1];
+        const float *wr = m_twRe[s];
+        const float *wi = m_twIm[s];
+        if (m_radix[s] == 2) {
+            const int stride = n / 2;
+            for (int j0 = 0; j0 < stride; j0 += span) {
+                const int d = j0 * 2;
+                for (int k = 0; k < span; k++) {
+                    const int j = j0 + k;
+                    const float ar = xr[j];
+                    const float ai = xi[j];
+                    const float br = xr[j + stride] * wr[k] - xi[j + stride] * wi[k];
+                    const float bi = xr[j + stride] * wi[k] + xi[j + stride] * wr[k];
+                    yr[d + k] = ar + br;
+                    yi[d + k] = ai + bi;
+                    yr[d + k + span] = ar - br;
+                    yi[d + k + span] = ai - bi;
+                }
+            }
+        } else {
+            const float s3 = 0.86602540378443864676f; // sin(pi/3)
+            const int stride = n / 3;
+            const float *w2r = wr + span;
+            const float *w2i = wi + span;
+            for (int j0 = 0; j0 < stride; j0 += span) {
+                const int d = j0 * 3;
+                for (int k = 0; k < span; k++) {
+                    const int j = j0 + k;
+                    const float ar = xr[j];
+                    const float ai = xi[j];
+                    const float br = xr[j + stride] * wr[k] - xi[j + stride] * wi[k];
+                    const float bi = xr[j + stride] * wi[k] + xi[j + stride] * wr[k];
+                    const float cr = xr[j + 2 * stride] * w2r[k] - xi[j + 2 * stride] * w2i[k];
+                    const float ci = xr[j + 2 * stride] * w2i[k] + xi[j + 2 * stride] * w2r[k];
+                    const float sr = br + cr;
+                    const float si = bi + ci;
+                    const float tr = ar - 0.5f * sr;
+                    const float ti = ai - 0.5f * si;
+                    const float dr = s3 * (br - cr);
+                    const float di = s3 * (bi - ci);
+                    yr[d + k] = ar + sr;
+                    yi[d + k] = ai + si;
+                    yr[d + k + span] = tr + di;
+                    yi[d + k + span] = ti - dr;
+                    yr[d + k + 2 * span] = tr - di;
+                    yi[d + k + 2 * span] = ti + dr;
+                }
+            }
+        }
+        src ^= 1;
+        span *= m_radix[s];
+    }
+    return src;
+}
+
+void BuiltinFft::forward(float *in, float *out) {
+    const int m = m_half;
+    float *zr = m_re[0];
+    float *zi = m_im[0];
+    for (int k = 0; k < m; k++) {
+        zr[k] = in[2 * k];
+        zi[k] = in[2 * k + 1];
+    }
+    const int r = complex_fft(0);
+    zr = m_re[r];
+    zi = m_im[r];
+    // split the packed transform into the spectrum of the real signal
+    out[0] = zr[0] + zi[0];
+    out[m] = zr[0] - zi[0];
+    for (int k = 1; k < m; k++) {
+        const float er = 0.5f * (zr[k] + zr[m - k]);
+        const float ei = 0.5f * (zi[k] - zi[m - k]);
+        const float orr = 0.5f * (zi[k] + zi[m - k]);
+        const float oi = -0.5f * (zr[k] - zr[m - k]);
+        out[k] = er + m_wRe[k] * orr - m_wIm[k] * oi;
+        out[m_size - k] = ei + m_wRe[k] * oi + m_wIm[k] * orr;
+    }
+}
+
+void BuiltinFft::backward(float *in, float *out) {
+    const int m = m_half;
+    float *zr = m_re[0];
+    float *zi = m_im[0];
+    // pack the spectrum into a half size complex one (scaled by 2)
+    for (int k = 0; k < m; k++) {
+        const float xr = in[k];
+        const float xi = k ? in[m_size - k] : 0.0f;
+        const float cr = in[m - k];
+        const float ci = k ? -in[m + k] : 0.0f; // conj(X[m-k])
+        const float er = xr + cr;
+        const float ei = xi + ci;
+        const float dr = xr - cr;
+        const float di = xi - ci;
+        const float orr = dr * m_wRe[k] + di * m_wIm[k];
+        const float oi = di * m_wRe[k] - dr * m_wIm[k];
+        zr[k] = er - oi;
+        // conjugated for the inverse transform
+        zi[k] = -(ei + orr);
+    }
+    const int r = complex_fft(0);
+    zr = m_re[r];
+    zi = m_im[r];
+    for (int k = 0; k < m; k++) {
+        out[2 * k] = zr[k];
+        out[2 * k + 1] = -zi[k];
+    }
+}
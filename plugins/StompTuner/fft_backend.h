@@ -0,0 +1,83 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#pragma once
+
+#ifndef FFT_BACKEND_H_
+#define FFT_BACKEND_H_
+
+#include <stddef.h>
+
+/****************************************************************
+ ** FftBackend
+ **
+ ** real <-> halfcomplex transforms in the fftw r2hc/hc2r layout
+ ** (r0, r1, .. r(n/2), i((n+1)/2-1), .. i1), unnormalized like fftw.
+ ** Two backends are available:
+ **   fftw     shared fftw plans (see fft_plans.h)
+ **   builtin  self-contained radix-2/3 real FFT, works for even sizes
+ **            of the form 2^a * 3^b, like 3072 = 2^10 * 3
+ ** Build with USE_FFTW=false to drop the fftw dependency, otherwise
+ ** the backend could be chosen at runtime with the environment
+ ** variable STOMPTUNER_FFT=fftw|builtin (default fftw).
+ */
+
+class FftBackend {
+public:
+    virtual ~FftBackend() {}
+    virtual bool is_valid() const = 0;
+    virtual const char *name() const = 0;
+    // out of place, in and out must be allocated with alloc_buffer()
+    virtual void forward(float *in, float *out) = 0;
+    // may destroy the input
+    virtual void backward(float *in, float *out) = 0;
+
+    // create the configured backend for a transform of the given size
+    static FftBackend *create(int size);
+    // SIMD aligned buffers
+    static float *alloc_buffer(size_t count);
+    static void free_buffer(float *buf);
+};
+
+/****************************************************************
+ ** BuiltinFft
+ **
+ ** the real transform of size n runs as a complex Stockham FFT of
+ ** size n/2 on split re/im arrays, followed by the usual post-
+ ** processing. Twiddles are precomputed per stage, all inner loops
+ ** run over contiguous memory, so the compiler could vectorize them.
+ */
+
+class BuiltinFft : public FftBackend {
+private:
+    int     m_size;
+    int     m_half;
+    int     m_nstages;
+    int     m_radix[32];
+    // per stage twiddles, (radix-1) * span values each
+    float  *m_twRe[32];
+    float  *m_twIm[32];
+    // post-processing twiddles exp(-2*pi*i*k/n)
+    float  *m_wRe;
+    float  *m_wIm;
+    // ping-pong work buffers for the complex transform
+    float  *m_re[2];
+    float  *m_im[2];
+    bool    m_valid;
+
+    // returns the buffer index holding the result
+    int     complex_fft(int src);
+
+public:
+    BuiltinFft(int size);
+    ~BuiltinFft();
+    bool is_valid() const override { return m_valid; }
+    const char *name() const override { return "builtin"; }
+    void forward(float *in, float *out) override;
+    void backward(float *in, float *out) override;
+};
+
+#endif  // FFT_BACKEND_H_
@@ -0,0 +1,276 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#include "fft_plans.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+FftPlans::Plan *FftPlans::list = 0;
+std::mutex FftPlans::mutex;
+std::mutex FftPlans::planner_mutex;
+bool FftPlans::measure_enabled = false;
+unsigned FftPlans::measure_flags = FFTW_MEASURE;
+bool FftPlans::configured = false;
+bool FftPlans::planning = false;
+std::condition_variable *FftPlans::planner_done = 0;
+
+static fftwf_plan make_plan(int size, fftwf_r2r_kind kind, unsigned flags) {
+    // plan on scratch buffers, instances execute it on their own ones
+    float *in = reinterpret_cast<float*>(fftwf_malloc(size * sizeof(float)));
+    float *out = reinterpret_cast<float*>(fftwf_malloc(size * sizeof(float)));
+    fftwf_plan plan = 0;
+    if (in && out) {
+        plan = fftwf_plan_r2r_1d(size, in, out, kind, flags);
+    }
+    fftwf_free(in);
+    fftwf_free(out);
+    return plan;
+}
+
+static void make_dir(const std::string& path) {
+#if defined(_WIN32)
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+std::string FftPlans::wisdom_file(bool create_dir) {
+    std::string path;
+#if defined(_WIN32)
+    const char *base = getenv("LOCALAPPDATA");
+    if (!base) return path;
+    path = base;
+#else
+    const char *base = getenv("XDG_CACHE_HOME");
+    if (base && *base) {
+        path = base;
+    } else {
+        base = getenv("HOME");
+        if (!base) return path;
+        path = std::string(base) + "/.cache";
+    }
+    if (create_dir) make_dir(path);
+#endif
+    path += "/stomptuner";
+    if (create_dir) make_dir(path);
+    return path + "/fftwf-wisdom";
+}
+
+// called with the mutex held
+void FftPlans::configure() {
+    if (configured) {
+        return;
+    }
+    configured = true;
+    const char *mode = getenv("STOMPTUNER_FFTW_PLANNING");
+    if (!mode) {
+        return;
+    }
+    if (strcmp(mode, "measure") == 0) {
+        measure_flags = FFTW_MEASURE;
+    } else if (strcmp(mode, "patient") == 0) {
+        measure_flags = FFTW_PATIENT;
+    } else {
+        return;
+    }
+    measure_enabled = true;
+    std::string file = wisdom_file(false);
+    if (!file.empty()) {
+        // no planner thread runs before the first acquire() is done
+        std::lock_guard<std::mutex> plock(planner_mutex);
+        fftwf_import_wisdom_from_filename(file.c_str());
+    }
+}
+
+void FftPlans::destroy(Plan *plan) {
+    {
+        std::lock_guard<std::mutex> plock(planner_mutex);
+        fftwf_plan current = plan->current.load(std::memory_order_acquire);
+        if (current != plan->estimate) {
+            fftwf_destroy_plan(current);
+        }
+        fftwf_destroy_plan(plan->estimate);
+    }
+    delete plan;
+}
+
+void FftPlans::save_wisdom() {
+    std::string file = wisdom_file(true);
+    if (!file.empty()) {
+        std::string tmp = file + ".tmp";
+        std::lock_guard<std::mutex> plock(planner_mutex);
+        if (fftwf_export_wisdom_to_filename(tmp.c_str())) {
+            if (std::rename(tmp.c_str(), file.c_str()) != 0) {
+                std::remove(file.c_str());
+                std::rename(tmp.c_str(), file.c_str());
+            }
+        }
+    }
+}
+
+// background planner, works through all plans not measured yet and
+// saves the wisdom, until no new size came in meanwhile. It takes the
+// registry lock only to pick the next one and to hand the result over,
+// never while fftw is measuring.
+void FftPlans::measure() {
+    bool saved = true;
+    for (;;) {
+        Plan *e;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            e = list;
+            while (e && e->measured) {
+                e = e->next;
+            }
+            if (!e && saved) {
+                planning = false;
+                planner_done->notify_all();
+                return;
+            }
+            if (e) {
+                e->measured = true;
+                e->busy = true;
+            }
+        }
+        if (!e) {
+            save_wisdom();
+            saved = true;
+            continue;
+        }
+        saved = false;
+        fftwf_plan plan;
+        {
+            std::lock_guard<std::mutex> plock(planner_mutex);
+            plan = make_plan(e->size, e->kind, measure_flags);
+        }
+        bool orphan;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            e->busy = false;
+            orphan = e->refc == 0;
+            if (plan && !orphan) {
+                e->current.store(plan, std::memory_order_release);
+                plan = 0;
+            }
+        }
+        if (plan) {
+            std::lock_guard<std::mutex> plock(planner_mutex);
+            fftwf_destroy_plan(plan);
+        }
+        if (orphan) {
+            destroy(e);
+        }
+        // give waiting instances a chance to plan their new sizes
+        std::this_thread::yield();
+    }
+}
+
+FftPlans::Plan *FftPlans::acquire(int size, fftwf_r2r_kind kind) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        configure();
+        for (Plan *e = list; e; e = e->next) {
+            if (e->size == size && e->kind == kind) {
+                e->refc++;
+                return e;
+            }
+        }
+    }
+    // a new size, plan it without the registry lock
+    fftwf_plan plan = 0;
+    bool measured = true;
+    {
+        std::lock_guard<std::mutex> plock(planner_mutex);
+        if (measure_enabled) {
+            // instant when the wisdom already knows this size
+            plan = make_plan(size, kind, measure_flags | FFTW_WISDOM_ONLY);
+        }
+        if (!plan) {
+            plan = make_plan(size, kind, FFTW_ESTIMATE);
+            measured = !measure_enabled;
+        }
+    }
+    if (!plan) {
+        return 0;
+    }
+    Plan *e = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // another instance may have added it meanwhile
+        for (e = list; e; e = e->next) {
+            if (e->size == size && e->kind == kind) {
+                e->refc++;
+                break;
+            }
+        }
+        if (!e) {
+            e = new Plan;
+            e->size = size;
+            e->kind = kind;
+            e->refc = 1;
+            e->measured = measured;
+            e->busy = false;
+            e->estimate = plan;
+            e->current.store(plan, std::memory_order_release);
+            e->next = list;
+            list = e;
+            plan = 0;
+            if (!measured && !planning) {
+                // a running planner picks it up by itself
+                if (!planner_done) {
+                    planner_done = new std::condition_variable();
+                }
+                planning = true;
+                std::thread(measure).detach();
+            }
+        }
+    }
+    if (plan) {
+        std::lock_guard<std::mutex> plock(planner_mutex);
+        fftwf_destroy_plan(plan);
+    }
+    return e;
+}
+
+void FftPlans::release(Plan *plan) {
+    if (!plan) {
+        return;
+    }
+    Plan *dead = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Plan *q = 0;
+        for (Plan *e = list; e; q = e, e = e->next) {
+            if (e == plan) {
+                if (--e->refc == 0) {
+                    if (q) q->next = e->next;
+                    else   list = e->next;
+                    // the planner deletes it when it's done with it
+                    if (!e->busy) {
+                        dead = e;
+                    }
+                }
+                break;
+            }
+        }
+        // don't leave a running thread behind when the plugin gets
+        // unloaded, with the list empty it only finishes the plan it
+        // is measuring
+        if (!list && planning) {
+            planner_done->wait(lock, [] { return !planning; });
+        }
+    }
+    if (dead) {
+        destroy(dead);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#pragma once
+
+#ifndef FFT_PLANS_H_
+#define FFT_PLANS_H_
+
+#include <fftw3.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/****************************************************************
+ ** FftPlans
+ **
+ ** process wide, reference counted registry of fftw r2r plans.
+ ** The fftw planner isn't thread-safe, so all planning and plan
+ ** destruction is serialized here by a planner lock, while hosts may
+ ** instantiate plugins in parallel. The registry has its own lock that
+ ** is never held while planning, so getting a size already known never
+ ** waits for the background planner. The plans are shared by all instances and
+ ** executed on per-instance buffers. The plans are made on fftwf_malloc()
+ ** scratch buffers, so fftw expects those to be aligned at least as
+ ** much, FftBackend::alloc_buffer() aligns them to 64 bytes, enough for
+ ** any fftw SIMD flavour.
+ **
+ ** Plans are made with FFTW_ESTIMATE, so session load stays instant.
+ ** When the environment variable STOMPTUNER_FFTW_PLANNING is set to
+ ** "measure" or "patient", fftw wisdom is loaded from a per-user cache
+ ** file. Sizes without wisdom get measured on a background thread and
+ ** the faster plan is swapped in once it is ready, the new wisdom is
+ ** then saved back to the cache.
+ */
+
+class FftPlans {
+public:
+    struct Plan {
+        Plan           *next;
+        int             size;
+        fftwf_r2r_kind  kind;
+        int             refc;
+        // set once the background planner took this one
+        bool            measured;
+        // the background planner is measuring it, it deletes it
+        // then when the last reference is gone meanwhile
+        bool            busy;
+        fftwf_plan      estimate;
+        // the best plan we have, may be swapped while in use
+        std::atomic<fftwf_plan> current;
+
+        void execute(float *in, float *out) const {
+            fftwf_execute_r2r(current.load(std::memory_order_acquire), in, out);
+        }
+    };
+
+    // get the shared plan for a transform of the given size and kind,
+    // returns 0 when fftw fails to plan it
+    static Plan *acquire(int size, fftwf_r2r_kind kind);
+    // drop a reference, the plan is destroyed with the last one
+    static void release(Plan *plan);
+
+private:
+    static Plan        *list;
+    // registry lock, for the list, the counts and the planner thread
+    static std::mutex   mutex;
+    // held for every call into the fftw planner
+    static std::mutex   planner_mutex;
+    // whether the background planner is enabled and its fftw flags
+    static bool         measure_enabled;
+    static unsigned     measure_flags;
+    static bool         configured;
+    // a detached planner thread is running, it clears this under the
+    // registry lock as its last step and signals planner_done. That one
+    // is made with the first planner and never deleted, so a planner
+    // still running at exit never finds it destroyed.
+    static bool         planning;
+    static std::condition_variable *planner_done;
+
+    static void configure();
+    static void measure();
+    static void save_wisdom();
+    // destroy the fftw plans and the entry, called with no lock held
+    static void destroy(Plan *plan);
+    static std::string wisdom_file(bool create_dir);
+};
+
+#endif  // FFT_PLANS_H_
@@ -5,6 +5,8 @@
 #ifndef LOW_HIGH_CUT_H
 #define LOW_HIGH_CUT_H
 
+#include <stdint.h>
+
 namespace low_high_cut {
 
 class Dsp {
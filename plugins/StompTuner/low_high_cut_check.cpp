@@ -0,0 +1,71 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license
+ */
+
+// compares low_high_cut::DspSimd against the faust double reference,
+// run it with "make check"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "low_high_cut.h"
+#include "low_high_cut.cc"
+#include "low_high_cut_simd.cc"
+
+// largest difference allowed, relative to the peak of the reference
+// (-80 dB), the float coefficients of the highpass get coarser with the
+// rate, the tracker itself runs it at 20.5 kHz
+static const double TOLERANCE = 1e-4;
+static const double SECONDS = 4.0;
+
+// sines across the range of a guitar, noise and some DC offset, in blocks
+// of changing size so the state is carried over between calls
+static bool check(uint32_t rate) {
+    const int count = static_cast<int>(rate * SECONDS);
+    std::vector<float> input(count);
+    std::vector<float> ref(count);
+    std::vector<float> out(count);
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        const double t = static_cast<double>(i) / rate;
+        input[i] = 0.05 + 0.2 * sin(2 * M_PI * 82.41 * t) + 0.15 * sin(2 * M_PI * 440.0 * t) +
+                   0.1 * sin(2 * M_PI * 2637.0 * t) + 0.05 * (rand() / (RAND_MAX * 0.5) - 1.0);
+    }
+
+    low_high_cut::Dsp *dsp = new low_high_cut::Dsp();
+    low_high_cut::Dsp::init_static(rate, dsp);
+    low_high_cut::DspSimd simd;
+    simd.init(rate);
+    for (int i = 0, n = 1; i < count; i += n, n = n % 256 + 7) {
+        n = std::min(n, count - i);
+        low_high_cut::Dsp::compute_static(n, &input[i], &ref[i], dsp);
+        simd.compute(n, &input[i], &out[i]);
+    }
+    low_high_cut::Dsp::del_instance(dsp);
+
+    const int delay = low_high_cut::DspSimd::DELAY;
+    double peak = 0;
+    double err = 0;
+    for (int i = 0; i + delay < count; i++) {
+        peak = std::max(peak, fabs(static_cast<double>(ref[i])));
+        err = std::max(err, fabs(static_cast<double>(out[i + delay]) - ref[i]));
+    }
+    const bool ok = err <= TOLERANCE * peak;
+    printf("%6u Hz: max abs error %.3g at peak %.3f %s\n", rate, err, peak, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main() {
+    // the analysis rate of the tracker first, then common host rates
+    static const uint32_t rates[] = { 20500, 44100, 48000, 96000 };
+    bool ok = true;
+    for (uint32_t rate : rates) {
+        ok = check(rate) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#include "low_high_cut_simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace low_high_cut {
+
+DspSimd::DspSimd() {
+    init(48000);
+}
+
+void DspSimd::clear_state_f() {
+#if defined(__GNUC__)
+    fS1 = fS2 = fY = v4sf{0.0f, 0.0f, 0.0f, 0.0f};
+#else
+    for (int k = 0; k < 4; k++) fS1[k] = fS2[k] = 0.0f;
+#endif
+    fNoise = 1e-20f;
+}
+
+// same constants as the faust code, mapped to biquad coefficients
+void DspSimd::init(uint32_t sample_rate) {
+    const double fConst0 = std::min<double>(192000.0, std::max<double>(1.0, double(sample_rate)));
+    const double fConst1 = std::tan((3138.4510609362032 / fConst0));
+    const double fConst2 = (1.0 / fConst1);
+    const double fConst3 = (1.0 / (((fConst2 + 0.76536686473017945) / fConst1) + 1.0));
+    const double fConst4 = (1.0 / (((fConst2 + 1.8477590650225735) / fConst1) + 1.0));
+    const double fConst5 = (72.256631032565238 / fConst0);
+    const double fConst6 = (1.0 / (fConst5 + 1.0));
+    const double fConst7 = (1.0 - fConst5);
+    const double fConst8 = (((fConst2 + -1.8477590650225735) / fConst1) + 1.0);
+    const double fConst9 = (2.0 * (1.0 - (1.0 / (fConst1 * fConst1))));
+    const double fConst10 = (((fConst2 + -0.76536686473017945) / fConst1) + 1.0);
+
+    // highpass, highpass, lowpass, lowpass
+    const float b0[4] = { float(fConst6), float(fConst6), float(fConst4), float(fConst3) };
+    const float b1[4] = { float(-fConst6), float(-fConst6), float(2.0 * fConst4), float(2.0 * fConst3) };
+    const float b2[4] = { 0.0f, 0.0f, float(fConst4), float(fConst3) };
+    const float a1[4] = { float(-fConst6 * fConst7), float(-fConst6 * fConst7),
+                          float(fConst4 * fConst9), float(fConst3 * fConst9) };
+    const float a2[4] = { 0.0f, 0.0f, float(fConst4 * fConst8), float(fConst3 * fConst10) };
+#if defined(__GNUC__)
+    fB0 = v4sf{b0[0], b0[1], b0[2], b0[3]};
+    fB1 = v4sf{b1[0], b1[1], b1[2], b1[3]};
+    fB2 = v4sf{b2[0], b2[1], b2[2], b2[3]};
+    fA1 = v4sf{a1[0], a1[1], a1[2], a1[3]};
+    fA2 = v4sf{a2[0], a2[1], a2[2], a2[3]};
+#else
+    for (int k = 0; k < 4; k++) {
+        fB0[k] = b0[k];
+        fB1[k] = b1[k];
+        fB2[k] = b2[k];
+        fA1[k] = a1[k];
+        fA2[k] = a2[k];
+    }
+#endif
+    clear_state_f();
+}
+
+void DspSimd::compute(int count, const float *input0, float *output0) {
+    float noise = fNoise;
+#if defined(__GNUC__)
+    const v4sf b0 = fB0, b1 = fB1, b2 = fB2, a1 = fA1, a2 = fA2;
+    v4sf s1 = fS1, s2 = fS2, y = fY;
+    for (int i = 0; i < count; i++) {
+        const v4sf x = {input0[i] + noise, y[0], y[1], y[2]};
+        noise = -noise;
+        y = b0 * x + s1;
+        s1 = b1 * x - a1 * y + s2;
+        s2 = b2 * x - a2 * y;
+        output0[i] = y[3];
+    }
+    fS1 = s1;
+    fS2 = s2;
+    fY = y;
+#else
+    float s1[4], s2[4];
+    for (int k = 0; k < 4; k++) {
+        s1[k] = fS1[k];
+        s2[k] = fS2[k];
+    }
+    for (int i = 0; i < count; i++) {
+        float x = input0[i] + noise;
+        noise = -noise;
+        for (int k = 0; k < 4; k++) {
+            const float y = fB0[k] * x + s1[k];
+            s1[k] = fB1[k] * x - fA1[k] * y + s2[k];
+            s2[k] = fB2[k] * x - fA2[k] * y;
+            x = y;
+        }
+        output0[i] = x;
+    }
+    for (int k = 0; k < 4; k++) {
+        fS1[k] = s1[k];
+        fS2[k] = s2[k];
+    }
+#endif
+    // keep the sign sequence going over block borders
+    fNoise = (count & 1) ? -fNoise : fNoise;
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#pragma once
+
+#ifndef LOW_HIGH_CUT_SIMD_H
+#define LOW_HIGH_CUT_SIMD_H
+
+#include <stdint.h>
+
+namespace low_high_cut {
+
+/****************************************************************
+ ** DspSimd
+ **
+ ** float version of the faust generated low/high cut (low_high_cut.cc,
+ ** which stays as reference, "make check" compares the two): 2 first
+ ** order highpass and 2 butterworth lowpass sections, each as transposed
+ ** direct form II biquad.
+ ** With gcc/clang vector extensions (SSE, NEON, ..) all 4 sections run
+ ** in one vector as a wavefront, lane k works on the sample lane k-1
+ ** had in the step before. That delays the output by 3 samples.
+ ** Without vector support the sections run one after the other for
+ ** each sample, with the state kept in locals for the whole block.
+ */
+
+class DspSimd {
+private:
+#if defined(__GNUC__)
+    typedef float v4sf __attribute__((vector_size(16)));
+    v4sf  fB0, fB1, fB2, fA1, fA2;
+    v4sf  fS1, fS2;
+    // last output of each section, feeds the next lane
+    v4sf  fY;
+#else
+    float fB0[4], fB1[4], fB2[4], fA1[4], fA2[4];
+    float fS1[4], fS2[4];
+#endif
+    // alternating tiny offset against denormals
+    float fNoise;
+
+public:
+    // samples the output lags behind the faust code
+#if defined(__GNUC__)
+    static const int DELAY = 3;
+#else
+    static const int DELAY = 0;
+#endif
+    DspSimd();
+    void clear_state_f();
+    void init(uint32_t sample_rate);
+    void compute(int count, const float *input0, float *output0);
+};
+
+}
+
+#endif
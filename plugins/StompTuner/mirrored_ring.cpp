@@ -0,0 +1,150 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#include "mirrored_ring.h"
+
+#include <cstring>
+
+#if defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+MirroredRing::MirroredRing()
+    : m_data(0),
+      m_size(0),
+      m_bytes(0),
+      m_mapped(false) {
+}
+
+MirroredRing::~MirroredRing() {
+    release();
+}
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+
+// reserve twice the size, then map the same memfd pages into both halves
+bool MirroredRing::map(size_t bytes) {
+    int fd = syscall(SYS_memfd_create, "stomptuner-ring", 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(0, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    char *lo = static_cast<char*>(base);
+    if (mmap(lo, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(lo + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * bytes);
+        close(fd);
+        return false;
+    }
+    // the mappings keep the memory alive
+    close(fd);
+    m_data = static_cast<float*>(base);
+    m_bytes = bytes;
+    m_mapped = true;
+    return true;
+}
+
+#else
+
+bool MirroredRing::map(size_t) {
+    return false;
+}
+
+#endif
+
+bool MirroredRing::allocate(int min_size) {
+    release();
+    if (min_size <= 0) {
+        return false;
+    }
+    size_t bytes = min_size * sizeof(float);
+#if defined(__linux__)
+    const size_t page = sysconf(_SC_PAGESIZE);
+    if (page > 0 && page % sizeof(float) == 0) {
+        const size_t mapped = (bytes + page - 1) / page * page;
+        if (map(mapped)) {
+            m_size = static_cast<int>(mapped / sizeof(float));
+            clear();
+            return true;
+        }
+    }
+#endif
+    // write twice fallback
+    m_data = new float[2 * min_size];
+    m_size = min_size;
+    m_bytes = 2 * bytes;
+    m_mapped = false;
+    clear();
+    return true;
+}
+
+void MirroredRing::release() {
+    if (!m_data) {
+        return;
+    }
+#if defined(__linux__)
+    if (m_mapped) {
+        munmap(m_data, 2 * m_bytes);
+    } else
+#endif
+    {
+        delete[] m_data;
+    }
+    m_data = 0;
+    m_size = 0;
+    m_bytes = 0;
+    m_mapped = false;
+}
+
+void MirroredRing::clear() noexcept {
+    if (m_data) {
+        // mapped, the second half follows the first
+        memset(m_data, 0, m_size * sizeof(float) * (m_mapped ? 1 : 2));
+    }
+}
+
+void MirroredRing::copy_from(const MirroredRing& other, int end, int count) noexcept {
+    if (!m_data || other.m_size != m_size || count <= 0) {
+        return;
+    }
+    if (count > m_size) {
+        count = m_size;
+    }
+    // the slice is contiguous in the other ring thanks to its mirror
+    const int pos = (end - count + m_size) % m_size;
+    write(pos, other.m_data + pos, count);
+}
+
+void MirroredRing::write(int pos, const float *input, int count) noexcept {
+    int n = m_size - pos;
+    if (n > count) {
+        n = count;
+    }
+    if (m_mapped) {
+        // any write is also seen through the other mapping
+        memcpy(m_data + pos, input, count * sizeof(float));
+        return;
+    }
+    memcpy(m_data + pos, input, n * sizeof(float));
+    memcpy(m_data + pos + m_size, input, n * sizeof(float));
+    if (count > n) {
+        memcpy(m_data, input + n, (count - n) * sizeof(float));
+        memcpy(m_data + m_size, input + n, (count - n) * sizeof(float));
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * StompTuner audio effect based on DISTRHO Plugin Framework (DPF)
+ *
+ * SPDX-License-Identifier:  GPL-2.0 license 
+ */
+
+#pragma once
+
+#ifndef MIRRORED_RING_H_
+#define MIRRORED_RING_H_
+
+#include <stddef.h>
+
+/****************************************************************
+ ** MirroredRing
+ **
+ ** ring buffer of floats whose storage is followed by a mirror of
+ ** itself, so data()[i + size()] == data()[i]. Any slice of up to
+ ** size() samples that starts inside the ring is contiguous in memory.
+ ** On Linux the same memfd pages are mapped twice back to back and the
+ ** mirror comes for free, elsewhere (or when mapping fails) the buffer
+ ** is allocated twice as long and write() stores every sample twice.
+ */
+
+class MirroredRing {
+public:
+    MirroredRing();
+    ~MirroredRing();
+    // at least min_size samples, rounded up to whole pages when mapped
+    bool  allocate(int min_size);
+    void  release();
+    bool  is_valid() const noexcept { return m_data != 0; }
+    bool  is_mapped() const noexcept { return m_mapped; }
+    int   size() const noexcept { return m_size; }
+    // 2 * size() readable samples
+    const float *data() const noexcept { return m_data; }
+    // copy count <= size() samples to position pos (0 <= pos < size())
+    void  write(int pos, const float *input, int count) noexcept;
+    void  clear() noexcept;
+    // take over the count samples before position end of a ring of the
+    // same size, the rest is left as it is
+    void  copy_from(const MirroredRing& other, int end, int count) noexcept;
+
+private:
+    float  *m_data;
+    int     m_size;
+    size_t  m_bytes;
+    bool    m_mapped;
+
+    bool    map(size_t bytes);
+};
+
+#endif  // MIRRORED_RING_H_
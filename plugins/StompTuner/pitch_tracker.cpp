@@ -19,6 +19,27 @@
  */
 
 #include "pitch_tracker.h"
+#include "low_high_cut_simd.cc"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 /****************************************************************
  ** Pitch Tracker
@@ -33,55 +54,603 @@
 static const int DOWNSAMPLE = 2;
 static const float SIGNAL_THRESHOLD_ON = 0.001;
 static const float SIGNAL_THRESHOLD_OFF = 0.0009;
+// time between two analysis hops, in seconds
 static const float TRACKER_PERIOD = 0.1;
-// The size of the read buffer
+// the input gate closes when the block RMS stayed below this part of the
+// lower threshold for GATE_HOLD seconds, longer than one window, so the
+// window in the read ring is quiet when the analysis stops
+static const float GATE_CLOSE = 0.5;
+static const float GATE_HOLD = 0.2;
+// onset detection on the analysis stream: the energy of a frame of
+// ONSET_FRAME samples jumping by ONSET_RATIO over both frames before (as
+// long as the period of the lowest note together) marks an attack, the window behind it is analysed as soon as it holds the
+// first window stage instead of waiting for the next period
+static const int ONSET_FRAME = 128;
+static const float ONSET_RATIO = 2.0;
+// The size of the analysis window
 static const int FFT_SIZE = 2048;
+// window stages: after an attack the window grows through these lengths
+// while the note sustains, a quick coarse reading first, then more
+// precision. Without progressive refinement only the 1024 stage (50 ms,
+// two periods of the lowest note) is used, followed by FFT_SIZE hops.
+static const int WINDOW_STAGES = PitchTracker::WINDOW_STAGES;
+static const int WINDOW_LENGTH[WINDOW_STAGES] = { 512, 1024, 2048, 4096 };
+static const int MAX_WINDOW = 4096;
+// tracking: a clear note is followed by computing the NSDF only for lags
+// within TRACK_RANGE of its last period, as long as the peak stays above
+// TRACK_CLARITY, otherwise the full search runs again
+static const float TRACK_RANGE = 0.03;
+static const float TRACK_CLARITY = 0.9;
+// load governor: when the analysis takes more than GOVERNOR_HIGH of the
+// hop time (smoothed by GOVERNOR_SMOOTH per job), or windows get skipped,
+// the quality goes one level down, after GOVERNOR_CALM jobs in a row
+// below GOVERNOR_LOW one level up again. From full quality down the
+// levels take a longer hop, then shorter windows and at last follow the
+// note with tracking only, searching all lags only when the track is lost.
+static const int QUALITY_LEVELS = PitchTracker::QUALITY_LEVELS;
+static const int QUALITY_HOP[QUALITY_LEVELS] = { 4, 2, 2, 1 };
+static const int QUALITY_STAGES[QUALITY_LEVELS] = { 2, 3, 4, 4 };
+static const float GOVERNOR_HIGH = 0.5;
+static const float GOVERNOR_LOW = 0.1;
+static const float GOVERNOR_SMOOTH = 0.25;
+static const int GOVERNOR_CALM = 50;
+// The read ring holds a few windows, the worker reads its window in place
+// and drops the result when the dsp overwrote it before it was done
+static const int RING_SIZE = 4 * MAX_WINDOW;
+// resampler output is moved into the read buffer in chunks of this size
+static const int CHUNK_SIZE = 256;
+
+///////////////////////// LOCK-FREE WINDOW EXCHANGE  //////////////////////
+
+PitchTrackerWindows::PitchTrackerWindows()
+    : m_middle(1),
+      m_back(0),
+      m_front(2) {
+    memset(m_info, 0, sizeof(m_info));
+}
+
+// hand the filled back slot over and take the parked one in exchange,
+// a window the worker didn't pick up yet is simply overwritten
+void PitchTrackerWindows::publish(const PitchTrackerWindowInfo& info) noexcept {
+    m_info[m_back] = info;
+    m_back = m_middle.exchange(m_back | NEW_DATA, std::memory_order_acq_rel) & ~NEW_DATA;
+}
+
+bool PitchTrackerWindows::has_new() const noexcept {
+    return m_middle.load(std::memory_order_acquire) & NEW_DATA;
+}
+
+// take the freshest window, if there is one
+bool PitchTrackerWindows::acquire() noexcept {
+    if (!has_new()) {
+        return false;
+    }
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~NEW_DATA;
+    return true;
+}
+
+///////////////////////// RESULT MAILBOX   //////////////////////
+
+PitchTrackerMailbox::PitchTrackerMailbox()
+    : m_seq(0),
+      m_freq(0),
+      m_level(0),
+      m_timestamp(0) {
+}
+
+void PitchTrackerMailbox::publish(float freq, float level, uint32_t timestamp) noexcept {
+    uint32_t seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_freq.store(freq, std::memory_order_relaxed);
+    m_level.store(level, std::memory_order_relaxed);
+    m_timestamp.store(timestamp, std::memory_order_relaxed);
+    m_seq.store(seq + 2, std::memory_order_release);
+}
+
+bool PitchTrackerMailbox::read(PitchTrackerResult& r) const noexcept {
+    uint32_t seq = m_seq.load(std::memory_order_acquire);
+    if ((seq & 1) || seq == r.seq) {
+        return false;
+    }
+    float freq = m_freq.load(std::memory_order_relaxed);
+    float level = m_level.load(std::memory_order_relaxed);
+    uint32_t timestamp = m_timestamp.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_seq.load(std::memory_order_relaxed) != seq) {
+        return false;
+    }
+    r.freq = freq;
+    r.level = level;
+    r.timestamp = timestamp;
+    r.seq = seq;
+    return true;
+}
+
+///////////////////////// RT-SAFE WAKEUP SIGNAL   //////////////////////
+
+#if defined(__APPLE__)
+
+PitchTrackerSignal::PitchTrackerSignal()
+    : m_sem(dispatch_semaphore_create(0)) {
+}
+
+PitchTrackerSignal::~PitchTrackerSignal() {
+    dispatch_release(static_cast<dispatch_semaphore_t>(m_sem));
+}
+
+void PitchTrackerSignal::post() noexcept {
+    dispatch_semaphore_signal(static_cast<dispatch_semaphore_t>(m_sem));
+}
+
+void PitchTrackerSignal::wait() noexcept {
+    dispatch_semaphore_wait(static_cast<dispatch_semaphore_t>(m_sem), DISPATCH_TIME_FOREVER);
+}
+
+#elif defined(_WIN32)
+
+PitchTrackerSignal::PitchTrackerSignal()
+    : m_sem(CreateSemaphoreA(NULL, 0, 0x7fffffff, NULL)) {
+}
+
+PitchTrackerSignal::~PitchTrackerSignal() {
+    CloseHandle(static_cast<HANDLE>(m_sem));
+}
+
+void PitchTrackerSignal::post() noexcept {
+    ReleaseSemaphore(static_cast<HANDLE>(m_sem), 1, NULL);
+}
+
+void PitchTrackerSignal::wait() noexcept {
+    WaitForSingleObject(static_cast<HANDLE>(m_sem), INFINITE);
+}
+
+#else
+
+PitchTrackerSignal::PitchTrackerSignal() {
+    sem_init(&m_sem, 0, 0);
+}
+
+PitchTrackerSignal::~PitchTrackerSignal() {
+    sem_destroy(&m_sem);
+}
+
+void PitchTrackerSignal::post() noexcept {
+    sem_post(&m_sem);
+}
+
+void PitchTrackerSignal::wait() noexcept {
+    while (sem_wait(&m_sem) != 0 && errno == EINTR) {}
+}
+
+#endif
+
+///////////////////////// SHARED ANALYSIS POOL   //////////////////////
+
+PitchTrackerQueue::PitchTrackerQueue()
+    : m_head(0),
+      m_tail(0) {
+    for (uint32_t i = 0; i < SIZE; i++) {
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_cells[i].job = 0;
+    }
+}
+
+bool PitchTrackerQueue::push(PitchTrackerWorker *job) noexcept {
+    uint32_t pos = m_head.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &m_cells[pos & (SIZE - 1)];
+        const int32_t diff = static_cast<int32_t>(cell->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    cell->job = job;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+PitchTrackerWorker *PitchTrackerQueue::pop() noexcept {
+    uint32_t pos = m_tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &m_cells[pos & (SIZE - 1)];
+        const int32_t diff = static_cast<int32_t>(cell->seq.load(std::memory_order_acquire) - (pos + 1));
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+    PitchTrackerWorker *job = cell->job;
+    cell->seq.store(pos + SIZE, std::memory_order_release);
+    return job;
+}
+
+std::mutex PitchTrackerPool::s_mutex;
+PitchTrackerPool *PitchTrackerPool::s_pool = 0;
+int PitchTrackerPool::s_refc = 0;
+
+// leave a core to the audio threads, or one thread per core given
+PitchTrackerPool::PitchTrackerPool()
+    : m_nthreads(static_cast<int>(std::thread::hardware_concurrency()) - 1),
+      m_execute(true),
+      m_next(0),
+      m_priority(0),
+      m_ncpus(0),
+      m_report(false),
+      m_lastReport(0),
+      m_latCount(0),
+      m_latSum(0),
+      m_latMax(0) {
+    configure();
+    if (m_ncpus > 0) {
+        m_nthreads = m_ncpus;
+    }
+    if (m_nthreads > MAX_THREADS) {
+        m_nthreads = MAX_THREADS;
+    } else if (m_nthreads < 1) {
+        m_nthreads = 1;
+    }
+    for (int i = 0; i < m_nthreads; i++) {
+        m_threads[i] = std::thread([this, i]() { thread_run(i); });
+    }
+}
+
+PitchTrackerPool::~PitchTrackerPool() {
+    m_execute.store(false, std::memory_order_release);
+    for (int i = 0; i < m_nthreads; i++) {
+        m_sig.post();
+    }
+    for (int i = 0; i < m_nthreads; i++) {
+        if (m_threads[i].joinable()) {
+            m_threads[i].join();
+        }
+    }
+    if (m_report) {
+        report("total");
+    }
+}
+
+// STOMPTUNER_WORKER_PRIORITY=<1-99>, STOMPTUNER_WORKER_CPUS=<list like 2,3 or 2-5>
+// and STOMPTUNER_WORKER_STATS=1
+void PitchTrackerPool::configure() {
+    const char *prio = getenv("STOMPTUNER_WORKER_PRIORITY");
+    if (prio) {
+        m_priority = std::max(0, std::min(99, atoi(prio)));
+    }
+    const char *cpus = getenv("STOMPTUNER_WORKER_CPUS");
+    while (cpus && *cpus && m_ncpus < 64) {
+        char *end;
+        const long first = strtol(cpus, &end, 10);
+        if (end == cpus) {
+            break;
+        }
+        long last = first;
+        if (*end == '-') {
+            cpus = end + 1;
+            last = strtol(cpus, &end, 10);
+            if (end == cpus) {
+                break;
+            }
+        }
+        for (long c = first; c <= last && c < 1024 && m_ncpus < 64; c++) {
+            if (c >= 0) {
+                m_cpus[m_ncpus++] = static_cast<int>(c);
+            }
+        }
+        cpus = *end == ',' ? end + 1 : end;
+    }
+    const char *stats = getenv("STOMPTUNER_WORKER_STATS");
+    m_report = stats && *stats && strcmp(stats, "0") != 0;
+}
+
+// called by each pool thread for itself. Without the permission for
+// realtime scheduling (rtprio limits) the thread just keeps running
+// with normal priority. Each thread gets one of the listed cores.
+void PitchTrackerPool::set_thread_options(int index) {
+#if defined(_WIN32)
+    if (m_priority > 0) {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+    }
+#else
+    if (m_priority > 0) {
+        sched_param param;
+        param.sched_priority = std::max(sched_get_priority_min(SCHED_FIFO),
+                               std::min(sched_get_priority_max(SCHED_FIFO), m_priority));
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0 && m_report) {
+            fprintf(stderr, "StompTuner: no realtime priority for the analysis (%s)\n", strerror(err));
+        }
+    }
+#endif
+#if defined(__linux__)
+    if (m_ncpus > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[index % m_ncpus], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+}
+
+uint64_t PitchTrackerPool::now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PitchTrackerPool::add_latency(uint64_t ns) noexcept {
+    m_latCount.fetch_add(1, std::memory_order_relaxed);
+    m_latSum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = m_latMax.load(std::memory_order_relaxed);
+    while (ns > max && !m_latMax.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+void PitchTrackerPool::latency(uint32_t& count, double& mean_ms, double& max_ms) const noexcept {
+    count = m_latCount.load(std::memory_order_relaxed);
+    mean_ms = count ? m_latSum.load(std::memory_order_relaxed) * 1e-6 / count : 0.0;
+    max_ms = m_latMax.load(std::memory_order_relaxed) * 1e-6;
+}
+
+void PitchTrackerPool::report(const char *when) const {
+    uint32_t count;
+    double mean_ms, max_ms;
+    latency(count, mean_ms, max_ms);
+    fprintf(stderr, "StompTuner: %s %u analysis jobs, scheduling latency mean %.3f ms, max %.3f ms\n",
+            when, count, mean_ms, max_ms);
+}
+
+bool PitchTrackerPool::get_latency(uint32_t& count, double& mean_ms, double& max_ms) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!s_pool) {
+        return false;
+    }
+    s_pool->latency(count, mean_ms, max_ms);
+    return true;
+}
+
+PitchTrackerPool *PitchTrackerPool::acquire() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (!s_pool) {
+        s_pool = new PitchTrackerPool();
+    }
+    s_refc++;
+    return s_pool;
+}
+
+void PitchTrackerPool::release() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (--s_refc == 0) {
+        delete s_pool;
+        s_pool = 0;
+    }
+}
+
+// phase of the hop grid for a new instance, the van der Corput sequence
+// (0, 1/2, 1/4, 3/4, 1/8, ..) keeps any number of instances spread
+// evenly over the hop period
+float PitchTrackerPool::next_phase() noexcept {
+    static std::atomic<uint32_t> count(0);
+    uint32_t n = count.fetch_add(1, std::memory_order_relaxed);
+    float phase = 0.0f;
+    for (float bit = 0.5f; n; n >>= 1, bit *= 0.5f) {
+        if (n & 1) {
+            phase += bit;
+        }
+    }
+    return phase;
+}
+
+int PitchTrackerPool::home() noexcept {
+    return m_next.fetch_add(1, std::memory_order_relaxed) % m_nthreads;
+}
+
+bool PitchTrackerPool::submit(PitchTrackerWorker *job, int home) noexcept {
+    for (int k = 0; k < m_nthreads; k++) {
+        if (m_queues[(home + k) % m_nthreads].push(job)) {
+            m_sig.post();
+            return true;
+        }
+    }
+    return false;
+}
+
+void PitchTrackerPool::thread_run(int index) {
+    set_thread_options(index);
+    for (;;) {
+        // wait for signal from dsp that work is to do
+        m_sig.wait();
+        if (!m_execute.load(std::memory_order_acquire)) {
+            break;
+        }
+        // own queue first, then steal, until all are empty. A pop fails
+        // on a slot another dsp claimed but didn't fill yet, the job
+        // behind it is only reached because its post wakes a thread
+        // that takes everything
+        for (;;) {
+            PitchTrackerWorker *job = 0;
+            for (int k = 0; k < m_nthreads && !job; k++) {
+                job = m_queues[(index + k) % m_nthreads].pop();
+            }
+            if (!job) {
+                break;
+            }
+            job->execute();
+        }
+        // the latency so far, now and then while the pool runs
+        if (index == 0 && m_report) {
+            const uint64_t t = now();
+            if (t - m_lastReport >= STATS_PERIOD) {
+                if (m_lastReport) {
+                    report("so far");
+                }
+                m_lastReport = t;
+            }
+        }
+    }
+}
 
 ///////////////////////// INTERNAL WORKER CLASS   //////////////////////
 
 PitchTrackerWorker::PitchTrackerWorker()
-    : _execute(false) {
+    : _state(STOPPED),
+      _signalled(0),
+      _pt(0),
+      _pool(0),
+      _home(0) {
 }
 
 PitchTrackerWorker::~PitchTrackerWorker() {
-    if( _execute.load(std::memory_order_acquire) ) {
+    if (_pool) {
         stop();
-    };
+    }
 }
 
+// no new jobs from here on, wait for a queued or running one to finish
 void PitchTrackerWorker::stop() {
-    _execute.store(false, std::memory_order_release);
-    if (_thd.joinable()) {
-        cv.notify_one();
-        _thd.join();
+    if (!_pool) {
+        return;
+    }
+    int s = IDLE;
+    while (!_state.compare_exchange_weak(s, STOPPED, std::memory_order_acq_rel)) {
+        if (s == STOPPED) {
+            break;
+        }
+        s = IDLE;
+        std::this_thread::yield();
     }
+    PitchTrackerPool::release();
+    _pool = 0;
 }
 
 void PitchTrackerWorker::start(PitchTracker *pt) {
-    if( _execute.load(std::memory_order_acquire) ) {
+    if (_pool) {
         stop();
-    };
-    _execute.store(true, std::memory_order_release);
-    _thd = std::thread([this, pt]() {
-        while (_execute.load(std::memory_order_acquire)) {
-            std::unique_lock<std::mutex> lk(m);
-            pt->busy.store(false, std::memory_order_release);
-            // wait for signal from dsp that work is to do
-            cv.wait(lk);
-            //do work
-            if (_execute.load(std::memory_order_acquire)) {
-                pt->static_run(pt);
+    }
+    _pt = pt;
+    _pool = PitchTrackerPool::acquire();
+    _home = _pool->home();
+    _state.store(IDLE, std::memory_order_release);
+}
+
+// called from the audio thread, queue the instance when it is idle,
+// when it is running let it run once more for the newest window
+void PitchTrackerWorker::signal() noexcept {
+    int s = _state.load(std::memory_order_acquire);
+    for (;;) {
+        if (s == IDLE) {
+            _signalled.store(PitchTrackerPool::now(), std::memory_order_relaxed);
+            if (_state.compare_exchange_weak(s, QUEUED, std::memory_order_acq_rel)) {
+                if (!_pool->submit(this, _home)) {
+                    // all full, the next window tries again
+                    _state.store(IDLE, std::memory_order_release);
+                }
+                return;
+            }
+        } else if (s == RUNNING) {
+            _signalled.store(PitchTrackerPool::now(), std::memory_order_relaxed);
+            if (_state.compare_exchange_weak(s, AGAIN, std::memory_order_acq_rel)) {
+                return;
             }
+        } else {
+            return;
         }
-        // when done
-    });
+    }
+}
+
+void PitchTrackerWorker::execute() {
+    _state.store(RUNNING, std::memory_order_seq_cst);
+    for (;;) {
+        _pool->add_latency(PitchTrackerPool::now() - _signalled.load(std::memory_order_relaxed));
+        PitchTracker::static_run(_pt);
+        int s = RUNNING;
+        if (_state.compare_exchange_strong(s, IDLE, std::memory_order_acq_rel)) {
+            return;
+        }
+        // a newer window came in meanwhile
+        _state.store(RUNNING, std::memory_order_release);
+    }
 }
 
 bool PitchTrackerWorker::is_running() const noexcept {
-    return ( _execute.load(std::memory_order_acquire) && 
-             _thd.joinable() );
+    return _pool != 0 && _state.load(std::memory_order_acquire) != STOPPED;
+}
+
+
+///////////////////////// INPUT GATE   //////////////////////
+
+PitchTrackerGate::PitchTrackerGate()
+    : m_open(false),
+      m_hold(0),
+      m_quiet(0) {
+}
+
+void PitchTrackerGate::reset() noexcept {
+    m_open = false;
+    m_quiet = 0;
+}
+
+// peak and RMS of a block in one pass
+void PitchTrackerGate::measure(int count, const float *input, float& peak, float& rms) noexcept {
+    float p = 0.0f;
+    float sq = 0.0f;
+    int i = 0;
+#if defined(__GNUC__)
+    typedef float v4sf __attribute__((vector_size(16)));
+    typedef int32_t v4si __attribute__((vector_size(16)));
+    v4sf vp = {0.0f, 0.0f, 0.0f, 0.0f};
+    v4sf vs = vp;
+    for (; i + 4 <= count; i += 4) {
+        v4sf x;
+        memcpy(&x, &input[i], sizeof(x));
+        vs += x * x;
+        const v4sf a = (v4sf)((v4si)x & 0x7fffffff);
+        const v4si gt = a > vp;
+        vp = (v4sf)(((v4si)a & gt) | ((v4si)vp & ~gt));
+    }
+    for (int k = 0; k < 4; k++) {
+        p = std::max(p, vp[k]);
+        sq += vs[k];
+    }
+#endif
+    for (; i < count; i++) {
+        p = std::max(p, std::fabs(input[i]));
+        sq += input[i] * input[i];
+    }
+    peak = p;
+    rms = count > 0 ? sqrtf(sq / count) : 0.0f;
 }
 
+bool PitchTrackerGate::process(int count, const float *input,
+                               float open_threshold, float close_threshold) noexcept {
+    float peak, rms;
+    measure(count, input, peak, rms);
+    if (peak >= open_threshold) {
+        m_open = true;
+        m_quiet = 0;
+    } else if (m_open) {
+        if (rms < close_threshold) {
+            m_quiet += count;
+            if (m_quiet >= m_hold) {
+                m_open = false;
+            }
+        } else {
+            m_quiet = 0;
+        }
+    }
+    return m_open;
+}
 
 /////////////////////////  PitchTracker Class   ////////////////////////
 
@@ -91,52 +660,111 @@ void *PitchTracker::static_run(void *p) {
     return NULL;
 }
 
-PitchTracker::PitchTracker(std::function<void ()>setFreq_)
-    : new_freq(setFreq_),
-      error(false),
-      tick(0),
-      resamp(),
+PitchTracker::PitchTracker(float hop_phase)
+    : error(false),
+      m_hopSize(1),
+      m_hopAt(0),
+      m_hopPhase(hop_phase < 0 ? PitchTrackerPool::next_phase() : hop_phase),
+      m_frames(0),
+      m_time(0),
+      m_seq(0),
+      decim(),
+      lhcut(),
       m_sampleRate(),
+      m_hostRate(0),
+      m_ready(false),
+      m_resume(true),
       fixed_sampleRate(41000),
+      m_hostRatio(1),
       m_freq(-1),
       signal_threshold_on(SIGNAL_THRESHOLD_ON),
       signal_threshold_off(SIGNAL_THRESHOLD_OFF),
       tracker_period(TRACKER_PERIOD),
       m_buffersize(),
-      m_fftSize(),
-      m_buffer(new float[FFT_SIZE]),
+      m_progressive(false),
+      m_windowLength(FFT_SIZE),
+      m_ring(),
       m_bufferIndex(0),
-      m_input(new float[FFT_SIZE]),
+      m_chunk(new float[CHUNK_SIZE]),
+      m_silenceSent(false),
+      m_onsetSum(0),
+      m_onsetPrev(0),
+      m_onsetPrev2(0),
+      m_onsetCount(0),
+      m_onsetPending(false),
+      m_onsetFrom(0),
+      m_onsetAt(0),
+      m_stage(0),
+      windows(),
+      m_input(0),
       m_audioLevel(false),
-      m_fftwPlanFFT(0),
-      m_fftwPlanIFFT(0) {
-    busy.store(false, std::memory_order_release);
-    const int size = FFT_SIZE + (FFT_SIZE+1) / 2;
-    m_fftwBufferTime = reinterpret_cast<float*>
-                       (fftwf_malloc(size * sizeof(*m_fftwBufferTime)));
-    m_fftwBufferFreq = reinterpret_cast<float*>
-                       (fftwf_malloc(size * sizeof(*m_fftwBufferFreq)));
-
-    memset(m_buffer, 0, FFT_SIZE * sizeof(*m_buffer));
-    memset(m_input, 0, FFT_SIZE * sizeof(*m_input));
-    memset(m_fftwBufferTime, 0, size * sizeof(*m_fftwBufferTime));
-    memset(m_fftwBufferFreq, 0, size * sizeof(*m_fftwBufferFreq));
-
-    worker.start(this);
-    if (!m_buffer || !m_input || !m_fftwBufferTime || !m_fftwBufferFreq) {
-        error = true;
+      m_quality(QUALITY_LEVELS - 1),
+      m_level(QUALITY_LEVELS - 1),
+      m_skipped(0),
+      m_load(0),
+      m_calm(0),
+      m_tracking(true),
+      m_trackLag(0),
+      m_clarity(0),
+      m_fftwBufferTime(0),
+      m_fftwBufferFreq(0) {
+    // buffers, transforms and the worker come with prewarm() and
+    // activate(), a plugin scan never gets that far
+    for (int s = 0; s < WINDOW_STAGES; s++) {
+        m_fft[s] = 0;
     }
+    update_hop();
 }
 
 
 PitchTracker::~PitchTracker() {
     worker.stop();
-    fftwf_destroy_plan(m_fftwPlanFFT);
-    fftwf_destroy_plan(m_fftwPlanIFFT);
-    fftwf_free(m_fftwBufferTime);
-    fftwf_free(m_fftwBufferFreq);
-    delete[] m_input;
-    delete[] m_buffer;
+    for (int s = 0; s < WINDOW_STAGES; s++) {
+        delete m_fft[s];
+    }
+    FftBackend::free_buffer(m_fftwBufferTime);
+    FftBackend::free_buffer(m_fftwBufferFreq);
+    delete[] m_chunk;
+}
+
+// thresholds, hop phase, window and tracking mode, and the quality
+// level the load allowed so far
+void PitchTracker::copy_settings(const PitchTracker& other) {
+    signal_threshold_on = other.signal_threshold_on;
+    signal_threshold_off = other.signal_threshold_off;
+    tracker_period = other.tracker_period;
+    set_progressive(other.m_progressive);
+    m_tracking = other.m_tracking;
+    // keep the place in the hop grid the instance got at first
+    m_hopPhase = other.m_hopPhase;
+    m_level = other.m_quality.load(std::memory_order_relaxed);
+    m_quality.store(m_level, std::memory_order_relaxed);
+    update_hop();
+}
+
+// go on with the stream of the tracker this one replaces at the same
+// rate, the filter states, the ring and the clocks,
+// so the analysis doesn't start from an empty ring that looks like a
+// new attack, or from a decimator that leaves a splice in the stream
+void PitchTracker::take_over(const PitchTracker& other) noexcept {
+    if (!m_resume || !m_ready || !other.m_ready || other.m_hostRate != m_hostRate ||
+            other.m_ring.size() != m_ring.size() || !decim.copy_state(other.decim)) {
+        return;
+    }
+    // no window handed over from now on reaches further back
+    m_ring.copy_from(other.m_ring, other.m_bufferIndex, MAX_WINDOW);
+    m_bufferIndex = other.m_bufferIndex;
+    m_onsetSum = other.m_onsetSum;
+    m_onsetPrev = other.m_onsetPrev;
+    m_onsetPrev2 = other.m_onsetPrev2;
+    m_onsetCount = other.m_onsetCount;
+    m_silenceSent = other.m_silenceSent;
+    gate = other.gate;
+    lhcut = other.lhcut;
+    m_time = other.m_time;
+    const uint32_t frames = other.m_frames.load(std::memory_order_relaxed);
+    m_frames.store(frames, std::memory_order_relaxed);
+    m_hopAt = next_hop(frames, m_time);
 }
 
 void PitchTracker::set_threshold(float v) {
@@ -154,6 +782,54 @@ void PitchTracker::set_fast_note_detection(bool v) {
 	signal_threshold_off = SIGNAL_THRESHOLD_OFF;
 	tracker_period = TRACKER_PERIOD;
     }
+    update_hop();
+}
+
+// time between two analysis hops, in seconds
+void PitchTracker::set_hop_period(float v) {
+    tracker_period = v;
+    update_hop();
+}
+
+// the same, given as the part the windows of two hops overlap (0 .. <1)
+void PitchTracker::set_overlap(float v) {
+    v = std::min(std::max(v, 0.0f), 0.99f);
+    const int window = m_progressive ? MAX_WINDOW : FFT_SIZE;
+    tracker_period = window * (1.0f - v) / (fixed_sampleRate / DOWNSAMPLE);
+    update_hop();
+}
+
+// let the window grow through the stages while a note sustains,
+// otherwise all hops use FFT_SIZE windows
+void PitchTracker::set_progressive(bool v) {
+    m_progressive = v;
+    m_windowLength = v ? MAX_WINDOW : FFT_SIZE;
+}
+
+// follow a clear note around its last period instead of searching all lags
+void PitchTracker::set_tracking(bool v) {
+    m_tracking = v;
+}
+
+// hop size in analysis samples, the next hop keeps its place unless
+// it now lies further away than a whole new hop
+void PitchTracker::update_hop() {
+    m_hopSize = std::max(1, static_cast<int>(tracker_period * QUALITY_HOP[m_level] *
+                                             (fixed_sampleRate / DOWNSAMPLE) + 0.5f));
+    const uint32_t frames = m_frames.load(std::memory_order_relaxed);
+    if (static_cast<int32_t>(m_hopAt - frames) > m_hopSize) {
+        m_hopAt = next_hop(frames, m_time);
+    }
+}
+
+// ring count of the next hop after the ring count frames, taken at host
+// frame time. The hops sit on a grid on the host clock, shifted by the
+// phase of this instance, so instances running in step with each other
+// still hand their windows to the pool at different times.
+uint32_t PitchTracker::next_hop(uint32_t frames, uint32_t time) const {
+    const double clock = time / m_hostRatio + m_hopPhase * m_hopSize;
+    const double d = m_hopSize - fmod(clock, static_cast<double>(m_hopSize));
+    return frames + std::max(1, static_cast<int>(d + 0.5));
 }
 
 bool PitchTracker::setParameters(int sampleRate, int buffersize) {
@@ -163,81 +839,247 @@ bool PitchTracker::setParameters(int sampleRate, int buffersize) {
         return false;
     }
     m_sampleRate = fixed_sampleRate / DOWNSAMPLE;
-    resamp.setup(sampleRate, m_sampleRate, 1, 16); // 16 == least quality
-
-    if (m_buffersize != buffersize) {
-        m_buffersize = buffersize;
-        m_fftSize = m_buffersize + (m_buffersize+1) / 2;
-        fftwf_destroy_plan(m_fftwPlanFFT);
-        fftwf_destroy_plan(m_fftwPlanIFFT);
-        m_fftwPlanFFT = fftwf_plan_r2r_1d(
-                            m_fftSize, m_fftwBufferTime, m_fftwBufferFreq,
-                            FFTW_R2HC, FFTW_ESTIMATE);
-        m_fftwPlanIFFT = fftwf_plan_r2r_1d(
-                             m_fftSize, m_fftwBufferFreq, m_fftwBufferTime,
-                             FFTW_HC2R, FFTW_ESTIMATE);
-    }
-
-    if (!m_fftwPlanFFT || !m_fftwPlanIFFT) {
-        error = true;
-        return false;
+    decim.setup(sampleRate, m_sampleRate);
+    m_hostRatio = static_cast<float>(sampleRate) / m_sampleRate;
+    gate.set_hold(static_cast<int>(sampleRate * GATE_HOLD));
+    // filter coefficients for the analysis rate
+    lhcut.init(m_sampleRate);
+
+    m_buffersize = buffersize;
+    // a transform for each window stage, all made up front,
+    // so switching stages never plans or allocates
+    for (int s = 0; s < WINDOW_STAGES; s++) {
+        if (!m_fft[s]) {
+            m_fft[s] = FftBackend::create(fft_size(WINDOW_LENGTH[s]));
+        }
+        if (!m_fft[s] || !m_fft[s]->is_valid()) {
+            error = true;
+            return false;
+        }
     }
 
     return !error;
 }
 
+// only take the rate, the setup for it is done by prewarm()
 void PitchTracker::init(unsigned int samplerate) {
-    setParameters(samplerate, FFT_SIZE);
+    if (m_hostRate != static_cast<int>(samplerate)) {
+        m_hostRate = samplerate;
+        m_ready = false;
+    }
+    if (worker.is_running()) {
+        prewarm();
+        reset();
+    }
+}
+
+// allocate the buffers and set up the transforms, the decimator and the
+// filter for the current rate, everything activate() needs besides the
+// worker. Could be called ahead of activation, does nothing when done.
+bool PitchTracker::prewarm() {
+    if (m_ready) {
+        return true;
+    }
+    if (error || m_hostRate <= 0) {
+        return false;
+    }
+    if (!m_fftwBufferTime) {
+        const int size = fft_size(MAX_WINDOW);
+        m_fftwBufferTime = FftBackend::alloc_buffer(size);
+        m_fftwBufferFreq = FftBackend::alloc_buffer(size);
+        if (!m_fftwBufferTime || !m_fftwBufferFreq) {
+            error = true;
+            return false;
+        }
+        memset(m_fftwBufferTime, 0, size * sizeof(*m_fftwBufferTime));
+        memset(m_fftwBufferFreq, 0, size * sizeof(*m_fftwBufferFreq));
+    }
+    if (!m_ring.is_valid()) {
+        m_ring.allocate(RING_SIZE);
+    }
+    if (!m_ring.is_valid() || !m_chunk) {
+        error = true;
+        return false;
+    }
+    if (!setParameters(m_hostRate, FFT_SIZE)) {
+        return false;
+    }
+    m_hopAt = next_hop(m_frames.load(std::memory_order_relaxed), m_time);
+    m_ready = true;
+    return true;
+}
+
+// start analysing, the worker joins the shared pool
+void PitchTracker::activate() {
+    if (!prewarm()) {
+        return;
+    }
+    reset();
+    worker.start(this);
+}
+
+// leave the pool, the buffers stay for the next activation, which
+// resets the dsp state. Only the worker is touched, so this is safe
+// while the dsp still feeds it.
+void PitchTracker::deactivate() {
+    worker.stop();
 }
 
 void PitchTracker::reset() {
-    tick = 0;
-    m_bufferIndex = 0;
-    resamp.reset();
+    m_frames.store(0, std::memory_order_relaxed);
+    m_time = 0;
+    m_hopAt = next_hop(0, 0);
+    m_onsetPending = false;
+    m_silenceSent = false;
+    gate.reset();
+    decim.reset();
+    lhcut.clear_state_f();
     m_freq = -1;
 }
 
-void PitchTracker::add(int count, float* input) {
-    if (error) {
+void PitchTracker::add(int count, const float* input) {
+    if (error || !m_ready) {
         return;
     }
-    resamp.inp_count = count;
-    resamp.inp_data = input;
-    for (;;) {
-        resamp.out_data = &m_buffer[m_bufferIndex];
-        int n = FFT_SIZE - m_bufferIndex;
-        resamp.out_count = n;
-        resamp.process();
-        n -= resamp.out_count; // n := number of output samples
-        if (!n) { // all soaked up by filter
-            return;
-        }
-        m_bufferIndex = (m_bufferIndex + n) % FFT_SIZE;
-        if (resamp.inp_count == 0) {
-            break;
+    // follow the quality level the worker asks for
+    const int quality = m_quality.load(std::memory_order_relaxed);
+    if (quality != m_level) {
+        m_level = quality;
+        update_hop();
+    }
+    // nothing to look at, skip all work, only tell the worker once
+    const bool was_open = gate.is_open();
+    if (!gate.process(count, input, signal_threshold_off, signal_threshold_off * GATE_CLOSE)) {
+        m_time += count;
+        if (was_open) {
+            // back on the grid once the gate opens again
+            m_hopAt = next_hop(m_frames.load(std::memory_order_relaxed), m_time);
+            m_onsetPending = false;
+            if (!m_silenceSent) {
+                m_silenceSent = true;
+                send_window(m_buffersize, m_time, false, true);
+            }
         }
+        return;
     }
-    if (++tick * count >= m_sampleRate * DOWNSAMPLE * tracker_period) {
-        if (busy.load(std::memory_order_acquire)) {
-            return;
+    for (int i = 0; i < count;) {
+        int n = std::min(count - i, decim.max_input(CHUNK_SIZE));
+        int out = decim.process(n, &input[i], m_chunk);
+        m_time += n;
+        lhcut.compute(out, m_chunk, m_chunk);
+        feed(m_chunk, out);
+        i += n;
+    }
+}
+
+// move a chunk into the read ring piece by piece, stopping at each hop
+// and onset position inside it, so the windows end exactly there,
+// however large the host blocks are
+void PitchTracker::feed(const float *input, int count) {
+    while (count > 0) {
+        const uint32_t frames = m_frames.load(std::memory_order_relaxed);
+        uint32_t next = m_hopAt;
+        if (m_onsetPending && static_cast<int32_t>(m_onsetAt - next) < 0) {
+            next = m_onsetAt;
+        }
+        const int n = std::max(1, std::min(count, static_cast<int>(next - frames)));
+        push(input, n);
+        input += n;
+        count -= n;
+        if (static_cast<int32_t>(frames + n - next) < 0) {
+            continue;
+        }
+        // host frame at the window end, the rest of the chunk is
+        // already counted in m_time
+        const uint32_t time = m_time - static_cast<uint32_t>(count * m_hostRatio + 0.5f);
+        m_hopAt = frames + n + m_hopSize;
+        if (m_onsetPending && next == m_onsetAt) {
+            // after an attack don't wait for the hop, analyse the part of
+            // the ring behind the attack, then the next longer part each
+            // time one more stage fits, the hops go on with the last one
+            const int length = WINDOW_LENGTH[m_stage];
+            const bool attack = m_stage == (m_progressive ? 0 : 1);
+            if (m_progressive && m_stage + 1 < QUALITY_STAGES[m_level]) {
+                m_stage++;
+                m_onsetAt = m_onsetFrom + WINDOW_LENGTH[m_stage];
+            } else {
+                m_onsetPending = false;
+            }
+            m_windowLength = m_progressive ? length : FFT_SIZE;
+            m_hopAt = next_hop(frames + n, time);
+            m_silenceSent = false;
+            send_window(length, time, !attack, false);
+            continue;
         }
-        busy.store(true, std::memory_order_release);
-        tick = 0;
-        copy();
-        worker.cv.notify_one();
+        m_silenceSent = false;
+        send_window(std::min(m_windowLength, window_limit(m_level)), time, true, false);
+    }
+}
+
+// longest window at the given quality level
+int PitchTracker::window_limit(int quality) const {
+    return WINDOW_LENGTH[QUALITY_STAGES[quality] - 1];
+}
+
+// the smallest stage that holds a window of the given length
+int PitchTracker::window_stage(int length) {
+    int stage = 0;
+    while (stage < WINDOW_STAGES - 1 && WINDOW_LENGTH[stage] < length) {
+        stage++;
     }
+    return stage;
 }
 
-void PitchTracker::copy() {
-    int start = (FFT_SIZE + m_bufferIndex - m_buffersize) % FFT_SIZE;
-    int end = (FFT_SIZE + m_bufferIndex) % FFT_SIZE;
-    int cnt = 0;
-    if (start >= end) {
-        cnt = FFT_SIZE - start;
-        memcpy(m_input, &m_buffer[start], cnt * sizeof(*m_input));
-        start = 0;
+// describe the newest window of the given length and hand it over, even
+// when the worker is still busy with the last one
+void PitchTracker::send_window(int length, uint32_t time, bool track, bool silent) {
+    PitchTrackerWindowInfo info;
+    info.stamp = m_frames.load(std::memory_order_relaxed);
+    info.time = time;
+    info.start = (m_bufferIndex + m_ring.size() - length) % m_ring.size();
+    info.length = length;
+    info.silent = silent;
+    info.track = track && (m_tracking || m_level == 0);
+    info.hop = m_hopSize;
+    // the worker didn't take the last window, it comes too late
+    if (windows.has_new()) {
+        m_skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+    windows.publish(info);
+    worker.signal();
+}
+
+// move new samples into the read ring and look for attacks
+inline void PitchTracker::push(const float *input, int count) {
+    const uint32_t frames = m_frames.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        const float x = input[i];
+        m_onsetSum += x * x;
+        if (++m_onsetCount == ONSET_FRAME) {
+            // energy flux, a loud enough frame well above the last two,
+            // a new attack restarts the stages once the first one is done
+            const int first = m_progressive ? 0 : 1;
+            const uint32_t now = frames + i + 1;
+            if ((!m_onsetPending || m_stage > first) &&
+                m_onsetSum > ONSET_RATIO * std::max(m_onsetPrev, m_onsetPrev2) &&
+                m_onsetSum > ONSET_FRAME * signal_threshold_on * signal_threshold_on) {
+                m_onsetPending = true;
+                m_onsetFrom = now;
+                m_stage = first;
+                m_onsetAt = now + WINDOW_LENGTH[first];
+            }
+            m_onsetPrev2 = m_onsetPrev;
+            m_onsetPrev = m_onsetSum;
+            m_onsetSum = 0;
+            m_onsetCount = 0;
+        }
     }
-    memcpy(&m_input[cnt], &m_buffer[start], (end - start) * sizeof(*m_input));
+    // count the samples before they land, so a worker reading the
+    // part of the ring they overwrite sees that afterwards
+    m_frames.store(frames + count, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_ring.write(m_bufferIndex, input, count);
+    m_bufferIndex = (m_bufferIndex + count) % m_ring.size();
 }
 
 inline float sq(float x) {
@@ -327,41 +1169,29 @@ static int findsubMaximum(float *input, int len, float threshold) {
     return -1;
 }
 
-void PitchTracker::run() {
-    float sum = 0.0;
-    for (int k = 0; k < m_buffersize; ++k) {
-        sum += fabs(m_input[k]);
-    }
-    float threshold = (m_audioLevel ? signal_threshold_off : signal_threshold_on);
-    m_audioLevel = (sum / m_buffersize >= threshold);
-    if ( m_audioLevel == false ) {
-        if (m_freq != 0) {
-            m_freq = 0;
-            new_freq();
-        }
-        return;
-    }
-
-    memcpy(m_fftwBufferTime, m_input, m_buffersize * sizeof(*m_fftwBufferTime));
-    memset(m_fftwBufferTime+m_buffersize, 0, (m_fftSize - m_buffersize) * sizeof(*m_fftwBufferTime));
-    fftwf_execute(m_fftwPlanFFT);
-    for (int k = 1; k < m_fftSize/2; k++) {
-        m_fftwBufferFreq[k] = sq(m_fftwBufferFreq[k]) + sq(m_fftwBufferFreq[m_fftSize-k]);
-        m_fftwBufferFreq[m_fftSize-k] = 0.0;
+// NSDF over all lags by autocorrelation through the FFT, returns the lag
+// of the pitch period or 0 when there is none
+float PitchTracker::search(FftBackend *fft, int fftSize, int length, double energy) {
+    memcpy(m_fftwBufferTime, m_input, length * sizeof(*m_fftwBufferTime));
+    memset(m_fftwBufferTime+length, 0, (fftSize - length) * sizeof(*m_fftwBufferTime));
+    fft->forward(m_fftwBufferTime, m_fftwBufferFreq);
+    for (int k = 1; k < fftSize/2; k++) {
+        m_fftwBufferFreq[k] = sq(m_fftwBufferFreq[k]) + sq(m_fftwBufferFreq[fftSize-k]);
+        m_fftwBufferFreq[fftSize-k] = 0.0;
     }
     m_fftwBufferFreq[0] = sq(m_fftwBufferFreq[0]);
-    m_fftwBufferFreq[m_fftSize/2] = sq(m_fftwBufferFreq[m_fftSize/2]);
+    m_fftwBufferFreq[fftSize/2] = sq(m_fftwBufferFreq[fftSize/2]);
 
-    fftwf_execute(m_fftwPlanIFFT);
+    fft->backward(m_fftwBufferFreq, m_fftwBufferTime);
 
-    double sumSq = 2.0 * static_cast<double>(m_fftwBufferTime[0]) / static_cast<double>(m_fftSize);
-    for (int k = 0; k < m_fftSize - m_buffersize; k++) {
-        m_fftwBufferTime[k] = m_fftwBufferTime[k+1] / static_cast<float>(m_fftSize);
+    double sumSq = 2.0 * energy;
+    for (int k = 0; k < fftSize - length; k++) {
+        m_fftwBufferTime[k] = m_fftwBufferTime[k+1] / static_cast<float>(fftSize);
     }
 
-    int count = (m_buffersize + 1) / 2;
+    int count = (length + 1) / 2;
     for (int k = 0; k < count; k++) {
-        sumSq  -= sq(m_input[m_buffersize-1-k]) + sq(m_input[k]);
+        sumSq  -= sq(m_input[length-1-k]) + sq(m_input[k]);
         // dividing by zero is very slow, so deal with it seperately
         if (sumSq > 0.0) {
             m_fftwBufferTime[k] *= 2.0 / sumSq;
@@ -370,27 +1200,212 @@ void PitchTracker::run() {
         }
     }
     const float thres = 0.99; // was 0.6
-        int maxAutocorrIndex = findsubMaximum(m_fftwBufferTime, count, thres);
-
-        float x = 0.0;
-        if (maxAutocorrIndex >= 0) {
-            parabolaTurningPoint(m_fftwBufferTime[maxAutocorrIndex-1],
-                                 m_fftwBufferTime[maxAutocorrIndex],
-                                 m_fftwBufferTime[maxAutocorrIndex+1],
-                                 maxAutocorrIndex+1, &x);
-            x = m_sampleRate / x;
-            if (x > 999.0) {  // precision drops above 1000 Hz
-                x = 0.0;
-            }
+    int maxAutocorrIndex = findsubMaximum(m_fftwBufferTime, count, thres);
+
+    float x = 0.0;
+    m_clarity = 0.0;
+    if (maxAutocorrIndex >= 0) {
+        parabolaTurningPoint(m_fftwBufferTime[maxAutocorrIndex-1],
+                             m_fftwBufferTime[maxAutocorrIndex],
+                             m_fftwBufferTime[maxAutocorrIndex+1],
+                             maxAutocorrIndex+1, &x);
+        m_clarity = m_fftwBufferTime[maxAutocorrIndex];
+    }
+    return x;
+}
+
+// sum of a[i] * b[i]
+static inline float dot(const float *a, const float *b, int count) {
+    float r = 0.0f;
+    int i = 0;
+#if defined(__GNUC__)
+    typedef float v4sf __attribute__((vector_size(16)));
+    v4sf v0 = {0.0f, 0.0f, 0.0f, 0.0f};
+    v4sf v1 = v0;
+    for (; i + 8 <= count; i += 8) {
+        v4sf a0, a1, b0, b1;
+        memcpy(&a0, &a[i], sizeof(a0));
+        memcpy(&a1, &a[i+4], sizeof(a1));
+        memcpy(&b0, &b[i], sizeof(b0));
+        memcpy(&b1, &b[i+4], sizeof(b1));
+        v0 += a0 * b0;
+        v1 += a1 * b1;
+    }
+    v0 += v1;
+    r = (v0[0] + v0[1]) + (v0[2] + v0[3]);
+#endif
+    for (; i < count; i++) {
+        r += a[i] * b[i];
+    }
+    return r;
+}
+
+// NSDF straight in the time domain, only for the lags around the last
+// period, returns 0 when the peak moved out of them or got unclear
+float PitchTracker::track(int length, double energy) {
+    const int lo = std::max(1, static_cast<int>(m_trackLag * (1.0f - TRACK_RANGE)) - 1);
+    const int hi = std::min((length + 1) / 2 - 1, static_cast<int>(m_trackLag * (1.0f + TRACK_RANGE)) + 2);
+    if (hi - lo < 2) {
+        return 0.0;
+    }
+    // energy of the overlapping parts, as in search()
+    double sumSq = 2.0 * energy;
+    for (int k = 0; k < lo; k++) {
+        sumSq -= sq(m_input[length-1-k]) + sq(m_input[k]);
+    }
+    float *nsdf = m_fftwBufferTime;
+    int best = 0;
+    for (int k = 0; k <= hi - lo; k++) {
+        const int tau = lo + k;
+        const float r = dot(m_input, m_input + tau, length - tau);
+        nsdf[k] = sumSq > 0.0 ? 2.0 * r / sumSq : 0.0;
+        if (nsdf[k] > nsdf[best]) {
+            best = k;
+        }
+        sumSq -= sq(m_input[length-1-tau]) + sq(m_input[tau]);
+    }
+    if (best == 0 || best == hi - lo || nsdf[best] < TRACK_CLARITY) {
+        return 0.0;
+    }
+    float x;
+    parabolaTurningPoint(nsdf[best-1], nsdf[best], nsdf[best+1], lo + best, &x);
+    m_clarity = nsdf[best];
+    return x;
+}
+
+void PitchTracker::run() {
+    if (!windows.acquire()) {
+        return;
+    }
+    const PitchTrackerWindowInfo& info = windows.front_info();
+    const uint64_t start = PitchTrackerPool::now();
+    if (analyse(info)) {
+        govern(PitchTrackerPool::now() - start, info.hop);
+    }
+}
+
+// sums of |x| and x*x in one pass, float within short blocks so the
+// loop vectorises, double across them
+static inline void level_energy(const float *x, int count, double *absSum, double *sqSum) {
+    double ra = 0.0;
+    double rs = 0.0;
+    for (int i = 0; i < count; i += 256) {
+        const int n = std::min(count, i + 256);
+        float a = 0.0f;
+        float s = 0.0f;
+        for (int k = i; k < n; k++) {
+            a += fabsf(x[k]);
+            s += x[k] * x[k];
+        }
+        ra += a;
+        rs += s;
+    }
+    *absSum = ra;
+    *sqSum = rs;
+}
+
+// the samples are read in place from the ring. Returns false when there
+// was nothing to analyse.
+bool PitchTracker::analyse(const PitchTrackerWindowInfo& info) {
+    m_input = m_ring.data() + info.start;
+    const int length = info.length;
+    double absSum = 0.0;
+    double energy = 0.0;
+    if (!info.silent) {
+        level_energy(m_input, length, &absSum, &energy);
+    }
+    const float level = absSum / length;
+    const int stage = window_stage(length);
+    FftBackend *fft = m_fft[stage];
+    const int fftSize = fft_size(WINDOW_LENGTH[stage]);
+    float threshold = (m_audioLevel ? signal_threshold_off : signal_threshold_on);
+    m_audioLevel = (level >= threshold);
+    if ( m_audioLevel == false ) {
+        m_trackLag = 0;
+        if (m_freq != 0) {
+            m_freq = 0;
+            mailbox.publish(m_freq, level, info.time);
         }
+        return false;
+    }
+
+    float lag = 0.0;
+    // a clear note is followed around its last period, after an attack
+    // or when the track got lost all lags are searched again
+    if (info.track && m_trackLag > 0) {
+        lag = track(length, energy);
+    }
+    if (lag <= 0) {
+        lag = search(fft, fftSize, length, energy);
+    }
+    float x = 0.0;
+    if (lag > 0) {
+        x = m_sampleRate / lag;
+        if (x > 999.0) {  // precision drops above 1000 Hz
+            x = 0.0;
+        }
+    }
+    m_trackLag = (x > 0 && m_clarity >= TRACK_CLARITY) ? lag : 0.0f;
+    // the dsp went on writing meanwhile, when it came round to the
+    // window before we were done the result is garbage, drop it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint32_t written = m_frames.load(std::memory_order_relaxed) - info.stamp;
+    if (written > static_cast<uint32_t>(m_ring.size() - length)) {
+        m_trackLag = 0;
+        m_skipped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    // a short stage may miss a low note, that isn't silence
+    const int limit = std::min(m_buffersize, window_limit(m_quality.load(std::memory_order_relaxed)));
+    if (x == 0 && length < limit) {
+        return true;
+    }
     if (m_freq != x) {
         m_freq = x;
-        new_freq();
+        mailbox.publish(m_freq, level, info.time);
+    }
+    return true;
+}
+
+// step the quality down when the analysis can't keep up with the hops,
+// and up again once it has plenty of time left for a while. A changed
+// level starts over with a fresh load, it's measured against a
+// different budget from now on.
+void PitchTracker::govern(uint64_t ns, int hop) {
+    float load = ns * 1e-9 * m_sampleRate / hop;
+    if (m_skipped.exchange(0, std::memory_order_relaxed)) {
+        load = 1.0f;
+    }
+    m_load += (load - m_load) * GOVERNOR_SMOOTH;
+    int quality = m_quality.load(std::memory_order_relaxed);
+    if (m_load > GOVERNOR_HIGH && quality > 0) {
+        quality--;
+    } else if (m_load < GOVERNOR_LOW && quality < QUALITY_LEVELS - 1) {
+        if (++m_calm < GOVERNOR_CALM) {
+            return;
+        }
+        quality++;
+    } else {
+        m_calm = 0;
+        return;
+    }
+    m_load = 0;
+    m_calm = 0;
+    m_quality.store(quality, std::memory_order_relaxed);
+}
+
+bool PitchTracker::get_result(PitchTrackerResult& r) {
+    r.seq = m_seq;
+    if (!mailbox.read(r)) {
+        return false;
     }
+    m_seq = r.seq;
+    return true;
 }
 
 float PitchTracker::get_estimated_note() {
-    return m_freq <= 0.0 ? 1000.0 : 12 * log2f(2.272727e-03f * m_freq);
+    const float freq = get_estimated_freq();
+    return freq <= 0.0 ? 1000.0 : 12 * log2f(2.272727e-03f * freq);
 }
 
 
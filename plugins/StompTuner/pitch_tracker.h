@@ -24,62 +24,348 @@
 #define PITCH_TRACKER_H_
 
 #include <assert.h>
-#include <zita-resampler/resampler.h>
-#include <fftw3.h>
+#include "decimator.h"
+#include "low_high_cut_simd.h"
+#include "fft_backend.h"
+#include "mirrored_ring.h"
 #include <cstring>
 #include <cmath>
-#include <functional>
+#include <stdint.h>
 
 #include <atomic>
-#include <thread>
 #include <mutex>
-#include <condition_variable>
+#include <thread>
+
+#if !defined(__APPLE__) && !defined(_WIN32)
+#include <semaphore.h>
+#endif
 
 class PitchTracker;
+class PitchTrackerWorker;
+
+///////////////////////// LOCK-FREE WINDOW EXCHANGE  //////////////////////
+
+// what the dsp already knows about a window when handing it over
+struct PitchTrackerWindowInfo {
+    // number of samples written to the read ring up to the window end
+    uint32_t stamp;
+    // host frame count at the end of the block the window was taken in
+    uint32_t time;
+    // offset of the first window sample in the read ring
+    int      start;
+    // number of samples in the window
+    int      length;
+    // the gate closed, report silence without looking at the samples
+    bool     silent;
+    // no attack right before, the worker may follow the last period
+    bool     track;
+    // hop size in analysis samples, the time budget of the analysis
+    int      hop;
+};
+
+// triple buffer between the dsp and the worker thread.
+// The samples stay in the read ring, only the window description is
+// handed over. The dsp always owns one back slot to fill, the worker
+// always owns one front slot to read, the third one is parked in
+// between. Both sides only swap indices, so nobody ever waits.
+
+class PitchTrackerWindows {
+private:
+    static const int NEW_DATA = 4;
+    // index of the parked slot, or'ed with NEW_DATA when it holds
+    // a window the worker didn't see yet
+    std::atomic<int> m_middle;
+    int m_back;
+    int m_front;
+
+public:
+    PitchTrackerWindowInfo m_info[3];
+
+public:
+    PitchTrackerWindows();
+    // dsp side
+    void  publish(const PitchTrackerWindowInfo& info) noexcept;
+    // worker side
+    bool  has_new() const noexcept;
+    bool  acquire() noexcept;
+    const PitchTrackerWindowInfo& front_info() const noexcept { return m_info[m_front]; }
+};
+
+///////////////////////// RESULT MAILBOX   //////////////////////
+
+struct PitchTrackerResult {
+    float    freq;
+    // mean absolute level of the analysed window
+    float    level;
+    // host frame count at the end of the block the window was taken in,
+    // it keeps counting while the input gate is closed
+    uint32_t timestamp;
+    uint32_t seq;
+};
+
+// sequence numbered result slot (seqlock). Only the worker writes,
+// the dsp reads it once per block and never waits for it, a torn
+// read is just skipped and picked up with the next block
+
+class PitchTrackerMailbox {
+private:
+    // odd while the worker is writing
+    std::atomic<uint32_t> m_seq;
+    std::atomic<float>    m_freq;
+    std::atomic<float>    m_level;
+    std::atomic<uint32_t> m_timestamp;
+
+public:
+    PitchTrackerMailbox();
+    void  publish(float freq, float level, uint32_t timestamp) noexcept;
+    bool  read(PitchTrackerResult& r) const noexcept;
+    float freq() const noexcept { return m_freq.load(std::memory_order_relaxed); }
+};
+
+///////////////////////// RT-SAFE WAKEUP SIGNAL   //////////////////////
+
+// counting semaphore, post() never takes a lock and never blocks,
+// so it is safe to call from the audio thread
+
+class PitchTrackerSignal {
+private:
+#if defined(__APPLE__) || defined(_WIN32)
+    void *m_sem;
+#else
+    sem_t m_sem;
+#endif
+
+public:
+    PitchTrackerSignal();
+    ~PitchTrackerSignal();
+    void post() noexcept;
+    void wait() noexcept;
+};
+
+///////////////////////// SHARED ANALYSIS POOL   //////////////////////
+
+// bounded multi producer, multi consumer queue (after Dmitry Vyukov),
+// each cell carries a sequence number, so push and pop never lock
+
+class PitchTrackerQueue {
+private:
+    static const uint32_t SIZE = 256;
+    struct Cell {
+        std::atomic<uint32_t> seq;
+        PitchTrackerWorker   *job;
+    };
+    Cell m_cells[SIZE];
+    // producers and consumers on their own cache lines
+    std::atomic<uint32_t> m_head;
+    char m_pad[64];
+    std::atomic<uint32_t> m_tail;
+
+public:
+    PitchTrackerQueue();
+    // returns false when the queue is full
+    bool push(PitchTrackerWorker *job) noexcept;
+    // returns 0 when the queue is empty
+    PitchTrackerWorker *pop() noexcept;
+};
+
+// analysis threads shared by all tuner instances in the process, sized
+// to the cores. Each instance hands its jobs to a home queue, a thread
+// takes from its own queue first and then steals from the others, so a
+// burst from a few instances spreads over all threads.
+// The environment could ask for a realtime priority and a set of cores
+// for the threads (see README), and for a report of the scheduling
+// latency, the time from the dsp signalling a window to its analysis
+// starting. get_latency() reads it at any time.
+
+class PitchTrackerPool {
+private:
+    static const int MAX_THREADS = 8;
+    // ns between two latency reports while the pool runs
+    static const uint64_t STATS_PERIOD = 10000000000ULL;
+    int m_nthreads;
+    std::atomic<bool> m_execute;
+    std::thread m_threads[MAX_THREADS];
+    PitchTrackerQueue m_queues[MAX_THREADS];
+    // one post per queued job
+    PitchTrackerSignal m_sig;
+    std::atomic<unsigned> m_next;
+    // SCHED_FIFO priority, 0 for normal scheduling
+    int m_priority;
+    // cores to run on, none set for any
+    int m_ncpus;
+    int m_cpus[64];
+    bool m_report;
+    // when pool thread 0 printed the latency the last time
+    uint64_t m_lastReport;
+    // scheduling latency in ns
+    std::atomic<uint32_t> m_latCount;
+    std::atomic<uint64_t> m_latSum;
+    std::atomic<uint64_t> m_latMax;
+
+    static std::mutex s_mutex;
+    static PitchTrackerPool *s_pool;
+    static int s_refc;
+
+    PitchTrackerPool();
+    ~PitchTrackerPool();
+    void thread_run(int index);
+    void configure();
+    void set_thread_options(int index);
+    void latency(uint32_t& count, double& mean_ms, double& max_ms) const noexcept;
+    void report(const char *when) const;
+
+public:
+    // the threads start with the first instance and end with the last
+    static PitchTrackerPool *acquire();
+    static void release();
+    // home queue for a new instance
+    int  home() noexcept;
+    // where in the hop period a new instance does its hops (0 .. <1)
+    static float next_phase() noexcept;
+    // called from the audio thread, returns false when all queues are full
+    bool submit(PitchTrackerWorker *job, int home) noexcept;
+    // called from a pool thread when a job starts, ns since it was signalled
+    void add_latency(uint64_t ns) noexcept;
+    // scheduling latency so far, returns false when the pool isn't running
+    static bool get_latency(uint32_t& count, double& mean_ms, double& max_ms);
+    // steady clock in ns
+    static uint64_t now() noexcept;
+};
 
 ///////////////////////// INTERNAL wORKER CLASS   //////////////////////
 
+// the per instance end of the pool. An instance is queued at most once
+// and runs on one thread at a time, a window coming in while it runs
+// makes it run again, so the newest window always gets analysed.
+
 class PitchTrackerWorker {
 private:
-    std::atomic<bool> _execute;
-    std::thread _thd;
-    std::mutex m;
+    enum { IDLE, QUEUED, RUNNING, AGAIN, STOPPED };
+    std::atomic<int> _state;
+    // when the dsp queued it or asked for another run
+    std::atomic<uint64_t> _signalled;
+    PitchTracker *_pt;
+    PitchTrackerPool *_pool;
+    int _home;
 
 public:
     PitchTrackerWorker();
     ~PitchTrackerWorker();
     void stop();
     void start(PitchTracker *pt);
+    void signal() noexcept;
     bool is_running() const noexcept;
-    std::condition_variable cv;
+    // called from a pool thread
+    void execute();
+};
+
+///////////////////////// INPUT GATE   //////////////////////
+
+// block level gate in front of the analysis, so idle instances skip the
+// decimation, the filter and the worker wakeups. It opens as soon as a
+// block peak crosses the open threshold and closes once the block RMS
+// stayed below the close threshold for the hold time.
+
+class PitchTrackerGate {
+private:
+    bool  m_open;
+    // hold time and quiet time so far, in samples
+    int   m_hold;
+    int   m_quiet;
+
+public:
+    PitchTrackerGate();
+    void  set_hold(int samples) noexcept { m_hold = samples; }
+    void  reset() noexcept;
+    bool  is_open() const noexcept { return m_open; }
+    // returns whether the gate is open for this block
+    bool  process(int count, const float *input,
+                  float open_threshold, float close_threshold) noexcept;
+    static void measure(int count, const float *input, float& peak, float& rms) noexcept;
 };
 
 /* ------------- Pitch Tracker ------------- */
 
 class PitchTracker {
  public:
-    PitchTracker(std::function<void ()>setFreq_);
+    // number of window lengths the analysis could step through
+    static const int WINDOW_STAGES = 4;
+    // quality levels of the load governor, QUALITY_LEVELS-1 is full quality
+    static const int QUALITY_LEVELS = 4;
+    // hop_phase: place in the hop grid, a new one is drawn when negative
+    explicit PitchTracker(float hop_phase = -1.0f);
     ~PitchTracker();
     void            init(unsigned int samplerate);
-    void            add(int count, float *input);
-    float           get_estimated_freq() { return m_freq < 0 ? 0 : m_freq; }
+    bool            prewarm();
+    void            activate();
+    void            deactivate();
+    void            add(int count, const float *input);
+    // fetch the newest result, returns false when nothing new arrived
+    bool            get_result(PitchTrackerResult& r);
+    float           get_estimated_freq() { return mailbox.freq(); }
     float           get_estimated_note();
+    // quality level the analysis currently runs at
+    int             get_quality() const { return m_quality.load(std::memory_order_relaxed); }
     void            reset();
+    float           hop_phase() const { return m_hopPhase; }
+    // whether prewarm() is done for the rate
+    bool            is_ready() const { return m_ready; }
+    // take over the settings of the tracker this one replaces
+    void            copy_settings(const PitchTracker& other);
+    // and its input stream, called from the dsp when it swaps them
+    void            take_over(const PitchTracker& other) noexcept;
+    // whether take_over() goes on with the stream, not after an activation
+    void            set_resume(bool v) { m_resume = v; }
     void            set_threshold(float v);
     void            set_fast_note_detection(bool v);
+    void            set_hop_period(float v);
+    void            set_overlap(float v);
+    void            set_progressive(bool v);
+    void            set_tracking(bool v);
     static void     *static_run(void* p);
-    std::atomic<bool> busy;
  private:
-    std::function<void ()> new_freq;
     bool            setParameters(int sampleRate, int fftSize );
     void            run();
-    void            copy();
+    bool            analyse(const PitchTrackerWindowInfo& info);
+    void            govern(uint64_t ns, int hop);
+    int             window_limit(int quality) const;
+    static int      window_stage(int length);
+    void            feed(const float *input, int count);
+    void            push(const float *input, int count);
+    void            send_window(int length, uint32_t time, bool track, bool silent);
+    float           search(FftBackend *fft, int fftSize, int length, double energy);
+    float           track(int length, double energy);
+    static int      fft_size(int length) { return length + (length+1) / 2; }
+    void            update_hop();
+    uint32_t        next_hop(uint32_t frames, uint32_t time) const;
     bool            error;
-    int             tick;
+    // hop size in analysis samples and ring count of the next hop
+    int             m_hopSize;
+    uint32_t        m_hopAt;
+    // part of a hop the hop grid of this instance is shifted by
+    float           m_hopPhase;
+    // number of samples written to the read ring, the worker
+    // checks it to see whether its window got overwritten meanwhile
+    std::atomic<uint32_t> m_frames;
+    // number of host frames fed to add()
+    uint32_t        m_time;
+    // sequence number of the last result handed to the dsp
+    uint32_t        m_seq;
+    PitchTrackerMailbox mailbox;
     PitchTrackerWorker worker;
-    Resampler       resamp;
+    PitchTrackerGate gate;
+    Decimator       decim;
+    // low/high cut, runs on the decimated stream
+    low_high_cut::DspSimd lhcut;
     int             m_sampleRate;
+    // host rate given to init() and whether prewarm() is done for it
+    int             m_hostRate;
+    bool            m_ready;
+    // go on with the stream of the replaced tracker
+    bool            m_resume;
     int             fixed_sampleRate;
+    // host frames per analysis sample
+    float           m_hostRatio;
     float           m_freq;
     // Value of the threshold above which
     // the processing is activated.
@@ -87,28 +373,62 @@ class PitchTracker {
     // Value of the threshold below which
     // the input audio signal is deactivated.
     float           signal_threshold_off;
-    // Time between frequency estimates (in seconds)
+    // Time between frequency estimates (in seconds), m_hopSize follows it
     float           tracker_period;
     // number of samples in input buffer
     int             m_buffersize;
-    // Size of the FFT window.
-    int             m_fftSize;
-    // The audio buffer that stores the input signal.
-    float           *m_buffer;
-    // Index of the first empty position in the buffer.
+    // grow the window through the stages while a note sustains, off
+    // unless asked for with set_progressive()
+    bool            m_progressive;
+    // window length of the periodic hops
+    int             m_windowLength;
+    // The audio ring that stores the input signal, a few windows long,
+    // so the worker could read its window in place while the dsp goes on.
+    MirroredRing    m_ring;
+    // Index of the first empty position in the ring.
     int             m_bufferIndex;
-    // buffer for input signal
-    float           *m_input;
+    // resampler output, moved into the buffer by push()
+    float           *m_chunk;
+    // a silent window was already handed to the worker
+    bool            m_silenceSent;
+    // onset detection: energy of the current and of the last two frames
+    float           m_onsetSum;
+    float           m_onsetPrev;
+    float           m_onsetPrev2;
+    int             m_onsetCount;
+    // an attack was seen at ring count m_onsetFrom, analyse window
+    // stage m_stage once the ring count reaches m_onsetAt
+    bool            m_onsetPending;
+    uint32_t        m_onsetFrom;
+    uint32_t        m_onsetAt;
+    int             m_stage;
+    // analysis windows handed over to the worker
+    PitchTrackerWindows windows;
+    // the window the worker is currently working on, inside m_ring
+    const float     *m_input;
     // Whether or not the input level is high enough.
     bool            m_audioLevel;
+    // load governor: the quality level set by the worker, the one the
+    // dsp follows, windows the dsp handed over before the worker took
+    // the last one, and the worker side smoothed load (analysis time per
+    // hop time) together with the count of calm jobs in a row
+    std::atomic<int> m_quality;
+    int             m_level;
+    std::atomic<uint32_t> m_skipped;
+    float           m_load;
+    int             m_calm;
+    // follow a clear note around its last period (lag in samples, 0 when
+    // there is nothing to follow) and the NSDF peak found for it
+    bool            m_tracking;
+    float           m_trackLag;
+    float           m_clarity;
     // Support buffer used to store signals in the time domain.
     float          *m_fftwBufferTime;
     // Support buffer used to store signals in the frequency domain.
     float          *m_fftwBufferFreq;
-    // Plan to compute the FFT of a given signal.
-    fftwf_plan      m_fftwPlanFFT;
-    // Plan to compute the IFFT of a given signal (with additional zero-padding).
-    fftwf_plan      m_fftwPlanIFFT;
+    // Transforms (FFT, and IFFT with additional zero-padding) of a given signal,
+    // one for each window stage.
+    FftBackend      *m_fft[WINDOW_STAGES];
 };
 
 
@@ -23,23 +23,122 @@
  ** class tuner
  */
 
-tuner::tuner(std::function<void ()>setFreq_)
+tuner::tuner()
     : // trackable(),
-      pitch_tracker(setFreq_) {}
+      current(new PitchTracker()),
+      pending(0),
+      rate(0),
+      warm(false),
+      active(false) {
+    retired[0] = 0;
+    retired[1] = 0;
+}
+
+tuner::~tuner() {
+    reclaim();
+    delete pending.load(std::memory_order_acquire);
+    delete current.load(std::memory_order_acquire);
+}
+
+// free the trackers the dsp doesn't use anymore
+void tuner::reclaim() {
+    for (int i = 0; i < 2; i++) {
+        delete retired[i].exchange(0, std::memory_order_acq_rel);
+    }
+}
+
+// the tracker waiting for the dsp, taken back, or a new one with the
+// settings of the one the dsp works with. It keeps the hop phase the
+// first tracker of the instance got, so the instances stay spread.
+PitchTracker *tuner::take() {
+    PitchTracker *t = pending.exchange(0, std::memory_order_acq_rel);
+    if (!t) {
+        const PitchTracker *cur = current.load(std::memory_order_acquire);
+        t = new PitchTracker(cur->hop_phase());
+        t->copy_settings(*cur);
+    }
+    return t;
+}
+
+// set it up for the rate and the activation state, then hand it over
+void tuner::publish(PitchTracker *t) {
+    t->init(rate);
+    if (warm || active) {
+        t->prewarm();
+    }
+    if (active) {
+        t->activate();
+    }
+    delete pending.exchange(t, std::memory_order_acq_rel);
+}
 
+// nothing set up yet only takes the rate, prewarm() or activate() build for it
 void tuner::init(unsigned int samplingFreq) {
-    pitch_tracker.init(samplingFreq);
+    std::lock_guard<std::mutex> lock(setup_mutex);
+    reclaim();
+    if (samplingFreq == rate) {
+        return;
+    }
+    rate = samplingFreq;
+    if (warm || active) {
+        publish(take());
+    }
 }
 
+// from now on each new tracker is set up before it's handed over
+void tuner::prewarm() {
+    std::lock_guard<std::mutex> lock(setup_mutex);
+    reclaim();
+    warm = true;
+    if (!pending.load(std::memory_order_acquire) &&
+            current.load(std::memory_order_acquire)->is_ready()) {
+        return;
+    }
+    publish(take());
+}
+
+// a waiting tracker, e.g. the one prewarm() made, just gets started,
+// stopping only makes the workers leave the pool
 int tuner::activate(bool start) {
-    if (!start) {
-        pitch_tracker.reset();
+    std::lock_guard<std::mutex> lock(setup_mutex);
+    reclaim();
+    active = start;
+    if (start) {
+        // a new activation starts from a reset stream, the old one may
+        // still hold what was played before the deactivation
+        PitchTracker *t = take();
+        t->set_resume(false);
+        publish(t);
+        return 0;
+    }
+    current.load(std::memory_order_acquire)->deactivate();
+    PitchTracker *t = pending.exchange(0, std::memory_order_acq_rel);
+    if (t) {
+        t->deactivate();
+        publish(t);
     }
     return 0;
 }
 
-void tuner::feed_tuner(int count, float* input) {
-    pitch_tracker.add(count, input);
+// take a new setup when there is one, the old one is left to the setup
+// thread, the dsp only swaps pointers
+void tuner::feed_tuner(int count, const float* input) {
+    if (pending.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 2; i++) {
+            if (retired[i].load(std::memory_order_acquire)) {
+                continue;
+            }
+            PitchTracker *t = pending.exchange(0, std::memory_order_acq_rel);
+            if (t) {
+                PitchTracker *old = current.load(std::memory_order_relaxed);
+                t->take_over(*old);
+                retired[i].store(old, std::memory_order_release);
+                current.store(t, std::memory_order_release);
+            }
+            break;
+        }
+    }
+    current.load(std::memory_order_relaxed)->add(count, input);
 }
 
 void tuner::del_instance(tuner *self)
@@ -27,25 +27,66 @@
 
 /****************************************************************
  ** class tuner
+ *
+ * Every change of the setup (rate, activation, settings) builds a new
+ * pitch tracker on the calling thread and hands it over to the dsp,
+ * which takes it at the start of the next feed_tuner(). The one it
+ * replaced is freed by the next setup call or the destructor, so the
+ * audio thread never allocates, frees or waits. All calls besides
+ * feed_tuner() and the getters are for non realtime threads.
  */
 
 class tuner {
 private:
-    PitchTracker pitch_tracker;
+    // the tracker the dsp works with, only replaced by feed_tuner()
+    std::atomic<PitchTracker*> current;
+    // a new one waiting for the dsp to take it
+    std::atomic<PitchTracker*> pending;
+    // the ones the dsp left behind, freed by the setup thread. Each setup
+    // call frees them first, so till the next one at most two come up,
+    // from the last and from this call.
+    std::atomic<PitchTracker*> retired[2];
+    // setup calls from more than one thread take turns
+    std::mutex setup_mutex;
+    unsigned int rate;
+    bool warm;
+    bool active;
+    void reclaim();
+    PitchTracker *take();
+    void publish(PitchTracker *t);
+    // the newest setup changed by change(), handed over as a new one
+    template <typename F> void reconfigure(F change) {
+        std::lock_guard<std::mutex> lock(setup_mutex);
+        reclaim();
+        PitchTracker *t = take();
+        change(*t);
+        publish(t);
+    }
 public:
-    // sigc::signal<void >& signal_freq_changed() { return pitch_tracker.new_freq; }
-   // Glib::Dispatcher& signal_freq_changed() { return pitch_tracker.new_freq; }
-    void feed_tuner(int count, float *input);
+    void feed_tuner(int count, const float *input);
     int activate(bool start);
     void init(unsigned int samplingFreq);
+    // buffers and transforms for the rate, ahead of activate()
+    void prewarm();
     static void del_instance(tuner *self);
-    float get_freq() { return pitch_tracker.get_estimated_freq(); }
-    float get_note() { return pitch_tracker.get_estimated_note(); }
+    float get_freq() { return current.load(std::memory_order_acquire)->get_estimated_freq(); }
+    bool get_new_freq(float& freq) {
+        PitchTrackerResult r;
+        if (!current.load(std::memory_order_acquire)->get_result(r)) return false;
+        freq = r.freq;
+        return true;
+    }
+    float get_note() { return current.load(std::memory_order_acquire)->get_estimated_note(); }
+    int get_quality() const { return current.load(std::memory_order_acquire)->get_quality(); }
     static inline float db2power(float db) {return pow(10.,db*0.05);}
-    static void set_threshold_level(tuner& self,float v) {self.pitch_tracker.set_threshold(db2power(v)); }
-    static void set_fast_note(tuner& self,bool v) {self.pitch_tracker.set_fast_note_detection(v); }
-    tuner(std::function<void ()>setFreq_);
-    ~tuner() {};
+    static void set_threshold_level(tuner& self,float v) {self.reconfigure([v](PitchTracker& t) { t.set_threshold(db2power(v)); }); }
+    static void set_fast_note(tuner& self,bool v) {self.reconfigure([v](PitchTracker& t) { t.set_fast_note_detection(v); }); }
+    static void set_hop_period(tuner& self,float v) {self.reconfigure([v](PitchTracker& t) { t.set_hop_period(v); }); }
+    static void set_overlap(tuner& self,float v) {self.reconfigure([v](PitchTracker& t) { t.set_overlap(v); }); }
+    static void set_progressive(tuner& self,bool v) {self.reconfigure([v](PitchTracker& t) { t.set_progressive(v); }); }
+    static void set_tracking(tuner& self,bool v) {self.reconfigure([v](PitchTracker& t) { t.set_tracking(v); }); }
+    tuner();
+    ~tuner();
 };
 
 #endif
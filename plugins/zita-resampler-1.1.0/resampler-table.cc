@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <thread>
 #include <zita-resampler/resampler-table.h>
 
 #ifndef M_PI
@@ -59,21 +60,57 @@ static double wind (double x)
 
 
 
-Resampler_table  *Resampler_table::_list = 0;
-Resampler_mutex   Resampler_table::_mutex;
+std::atomic<Resampler_table *>  Resampler_table::_list (0);
+
+
+// Frees the cached tables when the library is unloaded.
+
+class Resampler_list
+{
+public:
+
+    ~Resampler_list (void)
+    {
+	Resampler_table *P = Resampler_table::_list.exchange (0);
+	while (P)
+	{
+	    Resampler_table *Q = P->_next;
+	    delete P;
+	    P = Q;
+	}
+    }
+};
+
+static Resampler_list  resampler_list;
 
 
 Resampler_table::Resampler_table (double fr, unsigned int hl, unsigned int np) :
     _next (0),
     _refc (0),
+    _ready (false),
+    _ctab (0),
     _fr (fr),
     _hl (hl),
     _np (np)
 {
-    unsigned int  i, j;
-    double        t;
+}
+
+
+Resampler_table::~Resampler_table (void)
+{
+    delete[] _ctab;
+}
+
+
+void Resampler_table::fill (void)
+{
+    unsigned int  i, j, hl, np;
+    double        fr, t;
     float         *p;
 
+    fr = _fr;
+    hl = _hl;
+    np = _np;
     _ctab = new float [hl * (np + 1)];
     p = _ctab;
     for (j = 0; j <= np; j++)
@@ -86,67 +123,60 @@ Resampler_table::Resampler_table (double fr, unsigned int hl, unsigned int np) :
 	}
 	p += hl;
     }
+    _ready.store (true, std::memory_order_release);
 }
 
 
-Resampler_table::~Resampler_table (void)
+Resampler_table *Resampler_table::find (Resampler_table *P, Resampler_table *end,
+                                        double fr, unsigned int hl, unsigned int np)
 {
-    delete[] _ctab;
+    while (P != end)
+    {
+	if (P->match (fr, hl, np)) return P;
+	P = P->_next;
+    }
+    return 0;
 }
 
 
 Resampler_table *Resampler_table::create (double fr, unsigned int hl, unsigned int np)
 {
-    Resampler_table *P;
+    Resampler_table *H, *P, *T;
 
-    _mutex.lock ();
-    P = _list;
-    while (P)
+    H = _list.load (std::memory_order_acquire);
+    P = find (H, 0, fr, hl, np);
+    if (! P)
     {
-	if ((fr >= P->_fr * 0.999) && (fr <= P->_fr * 1.001) && (hl == P->_hl) && (np == P->_np))
+	// Publish an empty entry first, so that concurrent callers asking
+	// for the same table wait for this one instead of computing their
+	// own copy. Nothing is locked while the table is filled in.
+	T = new Resampler_table (fr, hl, np);
+	while (true)
 	{
-	    P->_refc++;
-            _mutex.unlock ();
-            return P;
+	    T->_next = H;
+	    if (_list.compare_exchange_weak (H, T, std::memory_order_acq_rel, std::memory_order_acquire))
+	    {
+		T->fill ();
+		P = T;
+		break;
+	    }
+	    P = find (H, T->_next, fr, hl, np);
+	    if (P)
+	    {
+		delete T;
+		break;
+	    }
 	}
-	P = P->_next;
     }
-    P = new Resampler_table (fr, hl, np);
-    P->_refc = 1;
-    P->_next = _list;
-    _list = P;
-    _mutex.unlock ();
+    while (! P->_ready.load (std::memory_order_acquire)) std::this_thread::yield ();
+    P->_refc.fetch_add (1, std::memory_order_relaxed);
     return P;
 }
 
 
 void Resampler_table::destroy (Resampler_table *T)
 {
-    Resampler_table *P, *Q;
-
-    _mutex.lock ();
-    if (T)
-    {
-	T->_refc--;
-	if (T->_refc == 0)
-	{
-	    P = _list;
-	    Q = 0;
-	    while (P)
-	    {
-		if (P == T)
-		{
-		    if (Q) Q->_next = T->_next;
-		    else      _list = T->_next;
-		    break;
-		}
-		Q = P;
-		P = P->_next;
-	    }
-	    delete T;
-	}
-    }
-    _mutex.unlock ();
+    if (T) T->_refc.fetch_sub (1, std::memory_order_relaxed);
 }
 
 
@@ -155,9 +185,9 @@ void Resampler_table::print_list (void)
     Resampler_table *P;
 
     printf ("Resampler table\n----\n");
-    for (P = _list; P; P = P->_next)
+    for (P = _list.load (std::memory_order_acquire); P; P = P->_next)
     {
-	printf ("refc = %3d   fr = %10.6lf  hl = %4d  np = %4d\n", P->_refc, P->_fr, P->_hl, P->_np);
+	printf ("refc = %3d   fr = %10.6lf  hl = %4d  np = %4d\n", P->_refc.load (), P->_fr, P->_hl, P->_np);
     }
     printf ("----\n\n");
 }
@@ -0,0 +1,215 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2006-2012 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __RESAMPLER_FIXED_SIMD_H
+#define __RESAMPLER_FIXED_SIMD_H
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESAMPLER_FIXED_HAVE_X86 1
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define RESAMPLER_FIXED_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__)
+#define RESAMPLER_FIXED_FLATTEN __attribute__((flatten))
+#else
+#define RESAMPLER_FIXED_FLATTEN
+#endif
+
+
+// Inner FIR loop of Resampler_fixed::process() for a single channel:
+//
+//   sum (i < HLEN) q1 [i] * c1 [i] + q2 [i] * c2 [HLEN - 1 - i]
+//
+// One kernel per instruction set, SSE2, AVX2+FMA and AVX-512 on x86,
+// NEON on ARM, plain C otherwise. Each is flattened into a copy of the
+// whole process() loop built for the same instruction set, setup() picks
+// the copy by CPU feature detection. The x86 kernels use per-function
+// target attributes, so the build flags stay as they are.
+
+enum
+{
+    RESAMPLER_FIXED_SCALAR,
+    RESAMPLER_FIXED_SSE2,
+    RESAMPLER_FIXED_AVX2,
+    RESAMPLER_FIXED_AVX512,
+    RESAMPLER_FIXED_NEON
+};
+
+
+// the part a vector loop leaves over
+template <unsigned int HLEN>
+static inline float resampler_fixed_tail (unsigned int i,
+                                                          const float *q1, const float *q2,
+                                                          const float *c1, const float *c2)
+{
+    float s = 0;
+    for (; i < HLEN; i++)
+    {
+	s += q1 [i] * c1 [i] + q2 [i] * c2 [HLEN - 1 - i];
+    }
+    return s;
+}
+
+
+template <unsigned int HLEN>
+struct Resampler_fixed_scalar
+{
+    static inline float dot (const float *q1, const float *q2,
+                                             const float *c1, const float *c2)
+    {
+	return resampler_fixed_tail <HLEN> (0, q1, q2, c1, c2);
+    }
+};
+
+
+#ifdef RESAMPLER_FIXED_HAVE_X86
+
+template <unsigned int HLEN>
+struct Resampler_fixed_sse2
+{
+    __attribute__((target("sse2")))
+    static inline float dot (const float *q1, const float *q2,
+                                             const float *c1, const float *c2)
+    {
+	unsigned int i;
+	__m128 s = _mm_setzero_ps ();
+	for (i = 0; i + 4 <= HLEN; i += 4)
+	{
+	    __m128 b = _mm_loadu_ps (c2 + HLEN - 4 - i);
+	    b = _mm_shuffle_ps (b, b, _MM_SHUFFLE (0, 1, 2, 3));
+	    s = _mm_add_ps (s, _mm_mul_ps (_mm_loadu_ps (q1 + i), _mm_loadu_ps (c1 + i)));
+	    s = _mm_add_ps (s, _mm_mul_ps (_mm_loadu_ps (q2 + i), b));
+	}
+	s = _mm_add_ps (s, _mm_movehl_ps (s, s));
+	s = _mm_add_ss (s, _mm_shuffle_ps (s, s, 1));
+	return _mm_cvtss_f32 (s) + resampler_fixed_tail <HLEN> (i, q1, q2, c1, c2);
+    }
+};
+
+template <unsigned int HLEN>
+struct Resampler_fixed_avx2
+{
+    __attribute__((target("avx2,fma")))
+    static inline float dot (const float *q1, const float *q2,
+                                             const float *c1, const float *c2)
+    {
+	unsigned int i;
+	const __m256i rev = _mm256_set_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 s = _mm256_setzero_ps ();
+	for (i = 0; i + 8 <= HLEN; i += 8)
+	{
+	    __m256 b = _mm256_permutevar8x32_ps (_mm256_loadu_ps (c2 + HLEN - 8 - i), rev);
+	    s = _mm256_fmadd_ps (_mm256_loadu_ps (q1 + i), _mm256_loadu_ps (c1 + i), s);
+	    s = _mm256_fmadd_ps (_mm256_loadu_ps (q2 + i), b, s);
+	}
+	__m128 h = _mm_add_ps (_mm256_castps256_ps128 (s), _mm256_extractf128_ps (s, 1));
+	h = _mm_add_ps (h, _mm_movehl_ps (h, h));
+	h = _mm_add_ss (h, _mm_shuffle_ps (h, h, 1));
+	return _mm_cvtss_f32 (h) + resampler_fixed_tail <HLEN> (i, q1, q2, c1, c2);
+    }
+};
+
+// gcc 12 avx512fintrin.h trips -Wmaybe-uninitialized on its own
+// _mm512_undefined_ps (), keep that out of the build log.
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template <unsigned int HLEN>
+struct Resampler_fixed_avx512
+{
+    __attribute__((target("avx512f")))
+    static inline float dot (const float *q1, const float *q2,
+                                             const float *c1, const float *c2)
+    {
+	unsigned int i;
+	__m512 s = _mm512_setzero_ps ();
+	for (i = 0; i + 16 <= HLEN; i += 16)
+	{
+	    __m512 b = _mm512_permute_ps (_mm512_loadu_ps (c2 + HLEN - 16 - i), _MM_SHUFFLE (0, 1, 2, 3));
+	    b = _mm512_shuffle_f32x4 (b, b, _MM_SHUFFLE (0, 1, 2, 3));
+	    s = _mm512_fmadd_ps (_mm512_loadu_ps (q1 + i), _mm512_loadu_ps (c1 + i), s);
+	    s = _mm512_fmadd_ps (_mm512_loadu_ps (q2 + i), b, s);
+	}
+	__m256 h = _mm256_add_ps (_mm512_castps512_ps256 (s),
+	                          _mm256_castpd_ps (_mm512_extractf64x4_pd (_mm512_castps_pd (s), 1)));
+	__m128 g = _mm_add_ps (_mm256_castps256_ps128 (h), _mm256_extractf128_ps (h, 1));
+	g = _mm_add_ps (g, _mm_movehl_ps (g, g));
+	g = _mm_add_ss (g, _mm_shuffle_ps (g, g, 1));
+	return _mm_cvtss_f32 (g) + resampler_fixed_tail <HLEN> (i, q1, q2, c1, c2);
+    }
+};
+
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+#ifdef RESAMPLER_FIXED_HAVE_NEON
+
+template <unsigned int HLEN>
+struct Resampler_fixed_neon
+{
+    static inline float dot (const float *q1, const float *q2,
+                                             const float *c1, const float *c2)
+    {
+	unsigned int i;
+	float32x4_t s = vdupq_n_f32 (0);
+	for (i = 0; i + 4 <= HLEN; i += 4)
+	{
+	    float32x4_t b = vrev64q_f32 (vld1q_f32 (c2 + HLEN - 4 - i));
+	    b = vcombine_f32 (vget_high_f32 (b), vget_low_f32 (b));
+	    s = vmlaq_f32 (s, vld1q_f32 (q1 + i), vld1q_f32 (c1 + i));
+	    s = vmlaq_f32 (s, vld1q_f32 (q2 + i), b);
+	}
+	float32x2_t h = vadd_f32 (vget_high_f32 (s), vget_low_f32 (s));
+	return vget_lane_f32 (vpadd_f32 (h, h), 0) + resampler_fixed_tail <HLEN> (i, q1, q2, c1, c2);
+    }
+};
+
+#endif
+
+
+// called from setup(), never from process()
+static inline int resampler_fixed_isa (unsigned int hlen)
+{
+#ifdef RESAMPLER_FIXED_HAVE_X86
+    __builtin_cpu_init ();
+    // the 16 wide loop only pays off for a few steps per call
+    if ((hlen >= 64) && __builtin_cpu_supports ("avx512f")) return RESAMPLER_FIXED_AVX512;
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma")) return RESAMPLER_FIXED_AVX2;
+    if (__builtin_cpu_supports ("sse2")) return RESAMPLER_FIXED_SSE2;
+#endif
+#ifdef RESAMPLER_FIXED_HAVE_NEON
+    return RESAMPLER_FIXED_NEON;
+#endif
+    (void) hlen;
+    return RESAMPLER_FIXED_SCALAR;
+}
+
+
+#endif
@@ -0,0 +1,368 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2006-2012 Fons Adriaensen <fons@linuxaudio.org>
+//    
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __RESAMPLER_FIXED_H
+#define __RESAMPLER_FIXED_H
+
+
+#include <string.h>
+#include <math.h>
+#include <zita-resampler/resampler-table.h>
+#include <zita-resampler/resampler-fixed-simd.h>
+
+
+// Resampler with the channel count and the filter half length fixed at
+// compile time, so the convolution has a constant trip count and stride
+// and the compiler can unroll and vectorize it.
+//
+// Unlike Resampler, HLEN is the actual half length of the filter for any
+// ratio. When downsampling the cutoff is moved down instead of growing
+// the filter, which keeps the cost per output sample constant but widens
+// the transition band for small ratios. Ratios below 2.6 / HLEN are
+// refused.
+//
+// A single channel runs the convolution in a SIMD kernel, setup() picks
+// the copy of process() built for the CPU, see resampler-fixed-simd.h.
+
+template <unsigned int NCHAN, unsigned int HLEN>
+class Resampler_fixed
+{
+public:
+
+    Resampler_fixed (void);
+    ~Resampler_fixed (void);
+
+    int  setup (unsigned int fs_inp,
+                unsigned int fs_out);
+
+    void   clear (void);
+    int    reset (void);
+    // continue where another one set up for the same rates stands
+    int    copy_state (const Resampler_fixed& other);
+    int    nchan (void) const { return NCHAN; }
+    int    inpsize (void) const { return 2 * HLEN; }
+    int    process (void) { return (this->*_proc) (); }
+
+    unsigned int         inp_count;
+    unsigned int         out_count;
+    float               *inp_data;
+    float               *out_data;
+
+private:
+
+    static unsigned int gcd (unsigned int a, unsigned int b);
+
+    // the loop of process() with the kernel K inlined, and a copy for
+    // each instruction set
+    template <class K> inline int run (void);
+    RESAMPLER_FIXED_FLATTEN int process_scalar (void);
+#ifdef RESAMPLER_FIXED_HAVE_X86
+    __attribute__((target("sse2"), flatten)) int process_sse2 (void);
+    __attribute__((target("avx2,fma"), flatten)) int process_avx2 (void);
+    __attribute__((target("avx512f"), flatten)) int process_avx512 (void);
+#endif
+#ifdef RESAMPLER_FIXED_HAVE_NEON
+    RESAMPLER_FIXED_FLATTEN int process_neon (void);
+#endif
+
+    Resampler_table     *_table;
+    int (Resampler_fixed::*_proc) (void);
+    unsigned int         _inmax;
+    unsigned int         _index;
+    unsigned int         _nread;
+    unsigned int         _nzero;
+    unsigned int         _phase;
+    unsigned int         _pstep;
+    float               *_buff;
+};
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+unsigned int Resampler_fixed <NCHAN, HLEN>::gcd (unsigned int a, unsigned int b)
+{
+    while (b)
+    {
+	unsigned int t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+Resampler_fixed <NCHAN, HLEN>::Resampler_fixed (void) :
+    _table (0),
+    _proc  (&Resampler_fixed::process_scalar),
+    _inmax (0),
+    _pstep (0),
+    _buff  (0)
+{
+    reset ();
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+Resampler_fixed <NCHAN, HLEN>::~Resampler_fixed (void)
+{
+    clear ();
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::setup (unsigned int fs_inp,
+                                          unsigned int fs_out)
+{
+    unsigned int       g, k, n, s;
+    double             r, frel;
+    float              *B = 0;
+    Resampler_table    *T = 0;
+
+    k = s = 0;
+    if (fs_inp && fs_out)
+    {
+	r = (double) fs_out / (double) fs_inp;
+        g = gcd (fs_out, fs_inp);
+        n = fs_out / g;
+	s = fs_inp / g;
+	frel = ((r < 1) ? r : 1.0) - 2.6 / HLEN;
+        if ((frel > 0) && (n <= 1000))
+	{
+	    k = 250;
+	    if (r < 1) k = (unsigned int)(ceil (k / r));
+            T = Resampler_table::create (frel, HLEN, n);
+	    B = new float [NCHAN * (2 * HLEN - 1 + k)];
+	}
+    }
+    clear ();
+    if (T)
+    {
+	_table = T;
+	switch (resampler_fixed_isa (HLEN))
+	{
+#ifdef RESAMPLER_FIXED_HAVE_X86
+	case RESAMPLER_FIXED_SSE2:   _proc = &Resampler_fixed::process_sse2; break;
+	case RESAMPLER_FIXED_AVX2:   _proc = &Resampler_fixed::process_avx2; break;
+	case RESAMPLER_FIXED_AVX512: _proc = &Resampler_fixed::process_avx512; break;
+#endif
+#ifdef RESAMPLER_FIXED_HAVE_NEON
+	case RESAMPLER_FIXED_NEON:   _proc = &Resampler_fixed::process_neon; break;
+#endif
+	default:                     _proc = &Resampler_fixed::process_scalar; break;
+	}
+	_buff  = B;
+	_inmax = k;
+	_pstep = s;
+	return reset ();
+    }
+    else return 1;
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+void Resampler_fixed <NCHAN, HLEN>::clear (void)
+{
+    Resampler_table::destroy (_table);
+    delete[] _buff;
+    _buff  = 0;
+    _table = 0;
+    _inmax = 0;
+    _pstep = 0;
+    reset ();
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::reset (void)
+{
+    inp_count = 0;
+    out_count = 0;
+    inp_data = 0;
+    out_data = 0;
+    _index = 0;
+    _nread = 0;
+    _nzero = 0;
+    _phase = 0; 
+    if (_table)
+    {
+        _nread = 2 * HLEN;
+	return 0;
+    }
+    return 1;
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::copy_state (const Resampler_fixed& other)
+{
+    if (!_table || (_table != other._table) || (_pstep != other._pstep) || (_inmax != other._inmax)) return 1;
+    // only the part of the input the filter still looks at
+    memcpy (_buff + other._index * NCHAN, other._buff + other._index * NCHAN,
+            NCHAN * (2 * HLEN - other._nread) * sizeof (float));
+    _index = other._index;
+    _nread = other._nread;
+    _nzero = other._nzero;
+    _phase = other._phase;
+    return 0;
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::process_scalar (void)
+{
+    return run <Resampler_fixed_scalar <HLEN> > ();
+}
+
+
+#ifdef RESAMPLER_FIXED_HAVE_X86
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::process_sse2 (void)
+{
+    return run <Resampler_fixed_sse2 <HLEN> > ();
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::process_avx2 (void)
+{
+    return run <Resampler_fixed_avx2 <HLEN> > ();
+}
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::process_avx512 (void)
+{
+    return run <Resampler_fixed_avx512 <HLEN> > ();
+}
+
+#endif
+
+
+#ifdef RESAMPLER_FIXED_HAVE_NEON
+
+template <unsigned int NCHAN, unsigned int HLEN>
+int Resampler_fixed <NCHAN, HLEN>::process_neon (void)
+{
+    return run <Resampler_fixed_neon <HLEN> > ();
+}
+
+#endif
+
+
+template <unsigned int NCHAN, unsigned int HLEN>
+template <class K>
+int Resampler_fixed <NCHAN, HLEN>::run (void)
+{
+    unsigned int   ph, np, dp, in, nr, nz, i, n, c;
+    float          *p1, *p2;
+
+    if (!_table) return 1;
+
+    np = _table->_np;
+    dp = _pstep;
+    in = _index;
+    nr = _nread;
+    ph = _phase;
+    nz = _nzero;
+    n = (2 * HLEN - nr) * NCHAN;
+    p1 = _buff + in * NCHAN;
+    p2 = p1 + n;
+
+    while (out_count)
+    {
+	if (nr)
+	{
+	    if (inp_count == 0) break;
+  	    if (inp_data)
+	    {
+                for (c = 0; c < NCHAN; c++) p2 [c] = inp_data [c];
+		inp_data += NCHAN;
+		nz = 0;
+	    }
+	    else
+	    {
+                for (c = 0; c < NCHAN; c++) p2 [c] = 0;
+		if (nz < 2 * HLEN) nz++;
+	    }
+	    nr--;
+	    p2 += NCHAN;
+	    inp_count--;
+	}
+	else
+	{
+	    if (out_data)
+	    {
+		if (nz < 2 * HLEN)
+		{
+		    const float *c1 = _table->_ctab + HLEN * ph;
+		    const float *c2 = _table->_ctab + HLEN * (np - ph);
+		    if (NCHAN == 1)
+		    {
+			*out_data++ = (1e-20f + K::dot (p1, p2 - HLEN, c1, c2)) - 1e-20f;
+		    }
+		    else for (c = 0; c < NCHAN; c++)
+		    {
+			const float *q1 = p1 + c;
+			const float *q2 = p2 + c - NCHAN * HLEN;
+			float s = 1e-20f;
+			// q2 runs backwards in Resampler, here c2 does
+			for (i = 0; i < HLEN; i++)
+			{
+			    s += q1 [i * NCHAN] * c1 [i] + q2 [i * NCHAN] * c2 [HLEN - 1 - i];
+			}
+			*out_data++ = s - 1e-20f;
+		    }
+		}
+		else
+		{
+		    for (c = 0; c < NCHAN; c++) *out_data++ = 0;
+		}
+	    }
+	    out_count--;
+
+	    ph += dp;
+	    if (ph >= np)
+	    {
+		nr = ph / np;
+		ph -= nr * np;
+		in += nr;
+		p1 += nr * NCHAN;
+		if (in >= _inmax)
+		{
+		    n = (2 * HLEN - nr) * NCHAN;
+		    memcpy (_buff, p1, n * sizeof (float));
+		    in = 0;
+		    p1 = _buff;
+		    p2 = p1 + n;
+		}
+	    }
+	}
+    }
+    _index = in;
+    _nread = nr;
+    _phase = ph;
+    _nzero = nz;
+
+    return 0;
+}
+
+
+#endif
@@ -22,7 +22,7 @@
 #define __RESAMPLER_TABLE_H
 
 
-#include <pthread.h>
+#include <atomic>
 
 
 #define ZITA_RESAMPLER_MAJOR_VERSION 1
@@ -33,20 +33,12 @@ extern int zita_resampler_major_version (void);
 extern int zita_resampler_minor_version (void);
 
 
-class Resampler_mutex
-{
-private:
-
-    friend class Resampler_table;
-
-    Resampler_mutex (void) { pthread_mutex_init (&_mutex, 0); }
-    ~Resampler_mutex (void) { pthread_mutex_destroy (&_mutex); }
-    void lock (void) { pthread_mutex_lock (&_mutex); }
-    void unlock (void) { pthread_mutex_unlock (&_mutex); }
-
-    pthread_mutex_t  _mutex;
-};
-
+// Tables are kept in a process wide list that is only ever prepended to.
+// Lookups walk it without a lock. A missing entry is published with a
+// compare-and-swap on the list head and filled in afterwards by the
+// thread that published it, others asking for it meanwhile wait. Tables
+// whose reference count drops to zero stay cached until the library is
+// unloaded, so a later setup() with the same parameters is just a lookup.
 
 class Resampler_table
 {
@@ -61,19 +53,30 @@ private:
 
     friend class Resampler;
     friend class VResampler;
-
-    Resampler_table     *_next;
-    unsigned int         _refc;
-    float               *_ctab;
-    double               _fr;
-    unsigned int         _hl;
-    unsigned int         _np;
-
+    template <unsigned int, unsigned int> friend class Resampler_fixed;
+    friend class Resampler_list;
+
+    bool match (double fr, unsigned int hl, unsigned int np) const
+    {
+	return (fr >= _fr * 0.999) && (fr <= _fr * 1.001) && (hl == _hl) && (np == _np);
+    }
+
+    void fill (void);
+
+    Resampler_table            *_next;
+    std::atomic<unsigned int>   _refc;
+    std::atomic<bool>           _ready;
+    float                      *_ctab;
+    double                      _fr;
+    unsigned int                _hl;
+    unsigned int                _np;
+
+    static Resampler_table *find (Resampler_table *P, Resampler_table *end,
+                                  double fr, unsigned int hl, unsigned int np);
     static Resampler_table *create (double fr, unsigned int hl, unsigned int np);
     static void destroy (Resampler_table *T);
 
-    static Resampler_table  *_list;
-    static Resampler_mutex   _mutex;
+    static std::atomic<Resampler_table *>  _list;
 };
 
 